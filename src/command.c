@@ -28,6 +28,7 @@
 #include "exception.h"
 #include "command.h"
 #include "gdb_packet.h"
+#include "gdb_main.h"
 #include "target.h"
 #include "target_internal.h"
 #include "morse.h"
@@ -47,6 +48,7 @@ static bool cmd_frequency(target *t, int argc, char **argv);
 static bool cmd_targets(target *t, int argc, char **argv);
 static bool cmd_morse(target *t, int argc, char **argv);
 static bool cmd_halt_timeout(target *t, int argc, const char **argv);
+static bool cmd_halt_poll(target *t, int argc, const char **argv);
 static bool cmd_connect_srst(target *t, int argc, const char **argv);
 static bool cmd_hard_srst(target *t, int argc, const char **argv);
 #ifdef PLATFORM_HAS_POWER_SWITCH
@@ -56,6 +58,9 @@ static bool cmd_target_power(target *t, int argc, const char **argv);
 static bool cmd_traceswo(target *t, int argc, const char **argv);
 #endif
 static bool cmd_heapinfo(target *t, int argc, const char **argv);
+static bool cmd_mem_cache(target *t, int argc, const char **argv);
+static bool cmd_flash_incremental(target *t, int argc, const char **argv);
+static bool cmd_flash_stats(target *t, int argc, const char **argv);
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 static bool cmd_debug_bmp(target *t, int argc, const char **argv);
 #endif
@@ -69,6 +74,7 @@ const struct command_s cmd_list[] = {
 	{"targets", (cmd_handler)cmd_targets, "Display list of available targets" },
 	{"morse", (cmd_handler)cmd_morse, "Display morse error message" },
 	{"halt_timeout", (cmd_handler)cmd_halt_timeout, "Timeout (ms) to wait until Cortex-M is halted: (Default 2000)" },
+	{"halt_poll", (cmd_handler)cmd_halt_poll, "Maximum interval (ms) between halt polls while running: (Default 32)" },
 	{"connect_srst", (cmd_handler)cmd_connect_srst, "Configure connect under SRST: (enable|disable)" },
 	{"hard_srst", (cmd_handler)cmd_hard_srst, "Force a pulse on the hard SRST line - disconnects target" },
 #ifdef PLATFORM_HAS_POWER_SWITCH
@@ -82,6 +88,9 @@ const struct command_s cmd_list[] = {
 #endif
 #endif
 	{"heapinfo", (cmd_handler)cmd_heapinfo, "Set semihosting heapinfo" },
+	{"mem_cache", (cmd_handler)cmd_mem_cache, "Cache target memory reads while halted: (enable|disable)" },
+	{"flash_incremental", (cmd_handler)cmd_flash_incremental, "Only erase and program flash blocks that changed: (enable|disable)" },
+	{"flash_stats", (cmd_handler)cmd_flash_stats, "Display statistics of the last flash operation" },
 #if defined(PLATFORM_HAS_DEBUG) && (PC_HOSTED == 0)
 	{"debug_bmp", (cmd_handler)cmd_debug_bmp, "Output BMP \"debug\" strings to the second vcom: (enable|disable)"},
 #endif
@@ -372,6 +381,23 @@ static bool cmd_halt_timeout(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool cmd_halt_poll(target *t, int argc, const char **argv)
+{
+	(void)t;
+	struct gdb_poll_stats stats;
+	if (argc > 1)
+		gdb_poll_max_interval = atol(argv[1]);
+	gdb_poll_stats_get(&stats);
+	gdb_outf("Maximum halt poll interval: %d ms\n", gdb_poll_max_interval);
+	gdb_outf("Last run: %" PRIu32 " polls in %" PRIu32 " ms",
+	         stats.last_polls, stats.last_run_ms);
+	if (stats.last_run_ms)
+		gdb_outf(" (%" PRIu32 " polls/s)",
+		         (uint32_t)(stats.last_polls * 1000ULL / stats.last_run_ms));
+	gdb_outf(", %" PRIu32 " polls total\n", stats.total_polls);
+	return true;
+}
+
 static bool cmd_hard_srst(target *t, int argc, const char **argv)
 {
 	(void)t;
@@ -494,3 +520,91 @@ static bool cmd_heapinfo(target *t, int argc, const char **argv)
 	} else gdb_outf("heapinfo heap_base heap_limit stack_base stack_limit\n");
 	return true;
 }
+
+static bool cmd_mem_cache(target *t, int argc, const char **argv)
+{
+	if (t == NULL) {
+		gdb_out("not attached\n");
+		return true;
+	}
+	if (argc == 2) {
+		bool enable;
+		if (!parse_enable_or_disable(argv[1], &enable))
+			return true;
+		if (!target_mem_cache_enable(t, enable)) {
+			gdb_out("Failed to allocate memory cache\n");
+			return false;
+		}
+	} else if (argc > 2) {
+		gdb_outf("Unrecognized command format\n");
+		return true;
+	}
+	uint32_t hits, misses, bypassed;
+	if (target_mem_cache_stats(t, &hits, &misses, &bypassed))
+		gdb_outf("Memory cache enabled: %" PRIu32 " hits, %" PRIu32
+		         " misses, %" PRIu32 " uncached reads\n",
+		         hits, misses, bypassed);
+	else
+		gdb_out("Memory cache disabled\n");
+	return true;
+}
+
+static bool cmd_flash_incremental(target *t, int argc, const char **argv)
+{
+	if (argc == 2) {
+		if (!parse_enable_or_disable(argv[1], &target_flash_incremental))
+			return true;
+	} else if (argc > 2) {
+		gdb_outf("Unrecognized command format\n");
+		return true;
+	}
+	gdb_outf("Incremental flashing %s\n",
+	         target_flash_incremental ? "enabled" : "disabled");
+	if (t) {
+		const struct target_flash_stats *stats = target_flash_stats(t);
+		gdb_outf("Last session: %" PRIu32 " of %" PRIu32
+		         " blocks unchanged\n", stats->inc_skipped,
+		         stats->inc_blocks);
+	}
+	return true;
+}
+
+static void show_flash_stats(const struct target_flash_stats *stats)
+{
+	gdb_outf("  %" PRIu32 " bytes requested, %" PRIu32 " programmed, %"
+	         PRIu32 " skipped in %" PRIu32 " erased buffers\n",
+	         stats->bytes_requested, stats->bytes_programmed,
+	         stats->bytes_skipped, stats->bufs_skipped);
+	gdb_outf("  %" PRIu32 " buffer flushes, %" PRIu32 " busy polls\n",
+	         stats->buf_flushes, stats->busy_polls);
+	gdb_outf("  Erase %" PRIu32 " ms for %" PRIu32 " blocks, bank erase %"
+	         PRIu32 " ms for %" PRIu32 " blocks\n", stats->erase_ms,
+	         stats->erase_blocks, stats->bank_erase_ms,
+	         stats->bank_erase_blocks);
+	gdb_outf("  Program %" PRIu32 " ms, CRC compare %" PRIu32 " ms\n",
+	         stats->program_ms, stats->crc_ms);
+}
+
+static void show_flash_region_stats(target_addr start, size_t length,
+                                    const struct target_flash_stats *stats,
+                                    void *context)
+{
+	(void)context;
+	gdb_outf("Flash at 0x%08" PRIx32 ", length 0x%" PRIx32 ":\n",
+	         start, (uint32_t)length);
+	show_flash_stats(stats);
+}
+
+static bool cmd_flash_stats(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	if (t == NULL) {
+		gdb_out("not attached\n");
+		return true;
+	}
+	target_flash_stats_foreach(t, show_flash_region_stats, NULL);
+	gdb_out("Total:\n");
+	show_flash_stats(target_flash_stats(t));
+	return true;
+}
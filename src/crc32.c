@@ -20,6 +20,8 @@
 
 #include "general.h"
 #include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
 #include "gdb_if.h"
 
 #if !defined(STM32F0) && !defined(STM32F1) && !defined(STM32F2) && \
@@ -100,7 +102,16 @@ static uint32_t crc32_calc(uint32_t crc, uint8_t data)
 
 void crc32_init(void) {}
 
-int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+uint32_t crc32_buffer(const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	uint32_t crc = -1;
+	while (len--)
+		crc = crc32_calc(crc, *data++);
+	return crc;
+}
+
+static int readback_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 {
 	uint32_t crc = -1;
 #if PC_HOSTED == 1
@@ -121,7 +132,7 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 		}
 		size_t read_len = MIN(sizeof(bytes), len);
 		if (target_mem_read(t, bytes, base, read_len)) {
-			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
+			DEBUG_WARN("readback_crc32 error around address 0x%08" PRIx32 "\n",
 					   base);
 			return -1;
 		}
@@ -144,7 +155,37 @@ void crc32_init(void)
 	rcc_periph_clock_enable(RCC_CRC);
 }
 
-int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+static uint32_t crc32_bitwise(uint32_t crc, const uint8_t *data, size_t len)
+{
+	while (len--) {
+		crc ^= *data++ << 24;
+		for (int i = 0; i < 8; i++) {
+			if (crc & 0x80000000)
+				crc = (crc << 1) ^ 0x4C11DB7;
+			else
+				crc <<= 1;
+		}
+	}
+	return crc;
+}
+
+uint32_t crc32_buffer(const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	size_t words = len & ~3;
+
+	if (!words)
+		return crc32_bitwise(-1, data, len);
+	CRC_CR |= CRC_CR_RESET;
+	for (size_t i = 0; i < words; i += 4) {
+		uint32_t word;
+		memcpy(&word, data + i, 4);
+		CRC_DR = __builtin_bswap32(word);
+	}
+	return crc32_bitwise(CRC_DR, data + words, len - words);
+}
+
+static int readback_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 {
 	uint8_t bytes[128];
 	uint32_t crc;
@@ -160,7 +201,7 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 		}
 		size_t read_len = MIN(sizeof(bytes), len) & ~3;
 		if (target_mem_read(t, bytes, base, read_len)) {
-			DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
+			DEBUG_WARN("readback_crc32 error around address 0x%08" PRIx32 "\n",
 					   base);
 			return -1;
 		}
@@ -175,22 +216,104 @@ int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
 	crc = CRC_DR;
 
 	if (target_mem_read(t, bytes, base, len)) {
-		DEBUG_WARN("generic_crc32 error around address 0x%08" PRIx32 "\n",
+		DEBUG_WARN("readback_crc32 error around address 0x%08" PRIx32 "\n",
 				   base);
 		return -1;
 	}
-	uint8_t *data = bytes;
-	while (len--) {
-		crc ^= *data++ << 24;
-		for (int i = 0; i < 8; i++) {
-			if (crc & 0x80000000)
-				crc = (crc << 1) ^ 0x4C11DB7;
-			else
-				crc <<= 1;
+	*crc_res = crc32_bitwise(crc, bytes, len);
+	return 0;
+}
+#endif
+
+/* Let a Cortex-M checksum its own memory, so verify time depends on the
+ * target clock and not on the debug link. The stub and its lookup table
+ * are loaded into target RAM, which is restored afterwards together with
+ * the core registers.
+ */
+static const uint16_t crc32_stub[] = {
+#include "flashstub/crc32.stub"
+};
+#define CRC32_STUB_TABLE_OFFSET	ALIGN(sizeof(crc32_stub), 4)
+#define CRC32_STUB_RAM_SIZE	(CRC32_STUB_TABLE_OFFSET + 256 * 4)
+/* Smaller regions are faster to read back than to set up the stub for */
+#define CRC32_STUB_MIN_LEN	0x4000
+/* Bytes per stub run, keeps each run well inside the stub timeout */
+#define CRC32_STUB_CHUNK	0x10000
+
+static int stub_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+{
+	/* t->cpuid is only set for Cortex-M cores */
+	if (!t->cpuid || (len < CRC32_STUB_MIN_LEN))
+		return -1;
+	/* Use RAM in the architectural SRAM region, which is executable.
+	 * The stub must stay clear of the range it checksums, so try both
+	 * ends of each region. */
+	uint32_t stub = 0;
+	for (struct target_ram *r = t->ram; r && !stub; r = r->next) {
+		if ((r->start < 0x20000000) || (r->start >= 0x40000000) ||
+		    (r->length < CRC32_STUB_RAM_SIZE))
+			continue;
+		uint32_t ends[2] = {
+			r->start,
+			(r->start + r->length - CRC32_STUB_RAM_SIZE) & ~3,
+		};
+		for (int i = 0; i < 2; i++) {
+			if ((ends[i] + CRC32_STUB_RAM_SIZE <= base) ||
+			    (ends[i] >= base + len)) {
+				stub = ends[i];
+				break;
+			}
+		}
+	}
+	if (!stub)
+		return -1;
+
+	uint32_t regs[t->regs_size / 4];
+	uint8_t *ram = malloc(CRC32_STUB_RAM_SIZE);
+	if (!ram) {			/* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return -1;
+	}
+	target_regs_read(t, regs);
+	if (target_mem_read(t, ram, stub, CRC32_STUB_RAM_SIZE)) {
+		free(ram);
+		return -1;
+	}
+
+	int ret = -1;
+	uint32_t crc = -1;
+	if (!target_mem_write(t, stub, crc32_stub, sizeof(crc32_stub))) {
+		uint32_t last_time = platform_time_ms();
+		while (len) {
+			uint32_t actual_time = platform_time_ms();
+			if ( actual_time > last_time + 1000) {
+				last_time = actual_time;
+				gdb_if_putchar(0, true);
+			}
+			size_t chunk = MIN(len, CRC32_STUB_CHUNK);
+			ret = cortexm_run_stub(t, stub, base, chunk,
+			                       stub + CRC32_STUB_TABLE_OFFSET, crc);
+			if (ret)
+				break;
+			target_reg_read(t, 0, &crc, sizeof(crc));
+			base += chunk;
+			len -= chunk;
 		}
 	}
+	target_mem_write(t, stub, ram, CRC32_STUB_RAM_SIZE);
+	free(ram);
+	target_regs_write(t, regs);
+	if (ret) {
+		DEBUG_WARN("CRC32 stub failed (%d), reading back\n", ret);
+		return -1;
+	}
 	*crc_res = crc;
 	return 0;
 }
-#endif
 
+int generic_crc32(target *t, uint32_t *crc_res, uint32_t base, size_t len)
+{
+	if (!stub_crc32(t, crc_res, base, len))
+		return 0;
+	return readback_crc32(t, crc_res, base, len);
+}
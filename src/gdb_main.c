@@ -43,15 +43,42 @@ enum gdb_signal {
 	GDB_SIGLOST = 29,
 };
 
-#define BUF_SIZE	1024
+/* Largest packet we accept, advertised to GDB as PacketSize.
+ * PC-hosted builds are not short of RAM and use large packets so bulk
+ * memory reads and flash writes are not dominated by packet overhead.
+ * Platforms may override this in their platform.h. */
+#if !defined(BUF_SIZE)
+# if PC_HOSTED == 1
+#  define BUF_SIZE	0x10000
+# else
+#  define BUF_SIZE	1024
+# endif
+#endif
 
 #define ERROR_IF_NO_TARGET()	\
 	if(!cur_target) { gdb_putpacketz("EFF"); break; }
 
-static char pbuf[BUF_SIZE+1];
+static SESSION_LOCAL char pbuf[BUF_SIZE+1];
 
-static target *cur_target;
-static target *last_target;
+/* Halt polling while the target runs. Polling starts right after resume
+ * and backs off exponentially up to gdb_poll_max_interval ms while the
+ * target keeps running. The wait is spent in gdb_if_getchar_to(), so a
+ * GDB interrupt ends it at once.
+ */
+unsigned gdb_poll_max_interval = 32;
+static SESSION_LOCAL unsigned poll_interval;
+static SESSION_LOCAL struct gdb_poll_stats poll_stats;
+
+/* State of one GDB connection. A target is only ever referenced by the
+ * session owning its target controller, so the destroy callback can
+ * find the session to clear from the controller alone.
+ */
+struct gdb_session {
+	struct target_controller tc;
+	target *cur_target;
+	target *last_target;
+	int target_n;		/* Target bound to this session, 0 if none */
+};
 
 static void handle_q_packet(char *packet, int len);
 static void handle_v_packet(char *packet, int len);
@@ -59,12 +86,12 @@ static void handle_z_packet(char *packet, int len);
 
 static void gdb_target_destroy_callback(struct target_controller *tc, target *t)
 {
-	(void)tc;
-	if (cur_target == t)
-		cur_target = NULL;
+	struct gdb_session *s = (struct gdb_session *)tc;
+	if (s->cur_target == t)
+		s->cur_target = NULL;
 
-	if (last_target == t)
-		last_target = NULL;
+	if (s->last_target == t)
+		s->last_target = NULL;
 }
 
 static void gdb_target_printf(struct target_controller *tc,
@@ -74,24 +101,50 @@ static void gdb_target_printf(struct target_controller *tc,
 	gdb_voutf(fmt, ap);
 }
 
-static struct target_controller gdb_controller = {
-	.destroy_callback = gdb_target_destroy_callback,
-	.printf = gdb_target_printf,
-
-	.open = hostio_open,
-	.close = hostio_close,
-	.read = hostio_read,
-	.write = hostio_write,
-	.lseek = hostio_lseek,
-	.rename = hostio_rename,
-	.unlink = hostio_unlink,
-	.stat = hostio_stat,
-	.fstat = hostio_fstat,
-	.gettimeofday = hostio_gettimeofday,
-	.isatty = hostio_isatty,
-	.system = hostio_system,
+static SESSION_LOCAL struct gdb_session session = {
+	.tc = {
+		.destroy_callback = gdb_target_destroy_callback,
+		.printf = gdb_target_printf,
+
+		.open = hostio_open,
+		.close = hostio_close,
+		.read = hostio_read,
+		.write = hostio_write,
+		.lseek = hostio_lseek,
+		.rename = hostio_rename,
+		.unlink = hostio_unlink,
+		.stat = hostio_stat,
+		.fstat = hostio_fstat,
+		.gettimeofday = hostio_gettimeofday,
+		.isatty = hostio_isatty,
+		.system = hostio_system,
+	},
 };
 
+#define cur_target	(session.cur_target)
+#define last_target	(session.last_target)
+#define gdb_controller	(session.tc)
+
+/* Let go of this session's target after an error. The targets of other
+ * sessions stay untouched. */
+void gdb_session_drop(void)
+{
+	if (cur_target)
+		target_release(cur_target);
+	cur_target = NULL;
+	last_target = NULL;
+}
+
+/* Attach to the target this session used last, or to the one bound to it */
+static target *gdb_reattach(void)
+{
+	if (last_target)
+		return target_attach(last_target, &gdb_controller);
+	if (session.target_n)
+		return target_attach_n(session.target_n, &gdb_controller);
+	return NULL;
+}
+
 int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 {
 	int size;
@@ -100,7 +153,9 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 	/* GDB protocol main loop */
 	while(1) {
 		SET_IDLE_STATE(1);
+		gdb_if_probe_unlock();
 		size = gdb_getpacket(pbuf, BUF_SIZE);
+		gdb_if_probe_lock();
 		SET_IDLE_STATE(0);
 		switch(pbuf[0]) {
 		/* Implementation of these is mandatory! */
@@ -129,6 +184,25 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 				gdb_putpacket(hexify(pbuf, mem, len), len*2);
 			break;
 			}
+		case 'x': {	/* 'x addr,len': Read len bytes from addr in binary */
+			uint32_t addr, len;
+			ERROR_IF_NO_TARGET();
+			sscanf(pbuf, "x%" SCNx32 ",%" SCNx32, &addr, &len);
+			if (len > sizeof(pbuf) - 2) {
+				gdb_putpacketz("E02");
+				break;
+			}
+			DEBUG_GDB("x packet: addr = %" PRIx32 ", len = %" PRIx32 "\n",
+					  addr, len);
+			/* Reply is 'b' followed by the raw data, escaping
+			 * is done by gdb_putpacket() */
+			pbuf[0] = 'b';
+			if (target_mem_read(cur_target, pbuf + 1, addr, len))
+				gdb_putpacketz("E01");
+			else
+				gdb_putpacket(pbuf, len + 1);
+			break;
+			}
 		case 'G': {	/* 'G XX': Write general registers */
 			ERROR_IF_NO_TARGET();
 			uint8_t arm_regs[target_regs_size(cur_target)];
@@ -182,13 +256,34 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 
 			/* Wait for target halt */
+			uint32_t run_start = platform_time_ms();
+			poll_interval = 0;
+			poll_stats.last_polls = 0;
 			while(!(reason = target_halt_poll(cur_target, &watch))) {
-				unsigned char c = gdb_if_getchar_to(0);
+				poll_stats.last_polls++;
+				gdb_if_probe_unlock();
+				unsigned char c = gdb_if_getchar_to(poll_interval);
+				gdb_if_probe_lock();
+				/* Another session may have rebuilt the target
+				 * list while the probe was free */
+				if (!cur_target)
+					break;
 				if((c == '\x03') || (c == '\x04')) {
 					target_halt_request(cur_target);
+					poll_interval = 0;
+				} else if (poll_interval < gdb_poll_max_interval) {
+					poll_interval = poll_interval ?
+						MIN(poll_interval * 2, gdb_poll_max_interval) : 1;
 				}
 			}
 			SET_RUN_STATE(0);
+			poll_stats.last_run_ms = platform_time_ms() - run_start;
+			poll_stats.total_polls += poll_stats.last_polls + 1;
+			if (!cur_target) {
+				gdb_putpacket_f("X%02X", GDB_SIGLOST);
+				morse("TARGET LOST.", true);
+				break;
+			}
 
 			/* Translate reason to GDB signal */
 			switch (reason) {
@@ -242,6 +337,8 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 
 		case 'F':	/* Semihosting call finished */
 			if (in_syscall) {
+				/* Target resumes, expect the next call soon */
+				poll_interval = 0;
 				return hostio_reply(tc, pbuf, size);
 			} else {
 				DEBUG_GDB("*** F packet when not in syscall! '%s'\n", pbuf);
@@ -281,11 +378,8 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 		case 'R':	/* Restart the target program */
 			if(cur_target)
 				target_reset(cur_target);
-			else if(last_target) {
-				cur_target = target_attach(last_target,
-						           &gdb_controller);
-				if(cur_target)
-					morse(NULL, false);
+			else if((cur_target = gdb_reattach())) {
+				morse(NULL, false);
 				target_reset(cur_target);
 			}
 			break;
@@ -309,6 +403,7 @@ int gdb_main_loop(struct target_controller *tc, bool in_syscall)
 			}
 
 		case 'q':	/* General query packet */
+		case 'Q':	/* General set packet */
 			handle_q_packet(pbuf, size);
 			break;
 
@@ -377,15 +472,22 @@ handle_q_packet(char *packet, int len)
 			gdb_putpacketz("E");
 
 	} else if (!strncmp (packet, "qSupported", 10)) {
-		/* Query supported protocol features */
-		gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+", BUF_SIZE);
+		/* Query supported protocol features.
+		 * This starts a new GDB session, so a NoAckMode left over
+		 * from a dropped connection must not apply to it. */
+		gdb_set_noackmode(false);
+		gdb_putpacket_f("PacketSize=%X;qXfer:memory-map:read+;qXfer:features:read+;QStartNoAckMode+;binary-upload+", BUF_SIZE);
+
+	} else if (!strcmp(packet, "QStartNoAckMode")) {
+		/* GDB acknowledges this reply, only later packets go without */
+		gdb_putpacketz("OK");
+		gdb_set_noackmode(true);
 
 	} else if (strncmp (packet, "qXfer:memory-map:read::", 23) == 0) {
 		/* Read target XML memory map */
-		if((!cur_target) && last_target) {
+		if(!cur_target) {
 			/* Attach to last target if detached. */
-			cur_target = target_attach(last_target,
-						   &gdb_controller);
+			cur_target = gdb_reattach();
 		}
 		if (!cur_target) {
 			gdb_putpacketz("E01");
@@ -397,10 +499,9 @@ handle_q_packet(char *packet, int len)
 
 	} else if (strncmp (packet, "qXfer:features:read:target.xml:", 31) == 0) {
 		/* Read target description */
-		if((!cur_target) && last_target) {
+		if(!cur_target) {
 			/* Attach to last target if detached. */
-			cur_target = target_attach(last_target,
-						   &gdb_controller);
+			cur_target = gdb_reattach();
 		}
 		if (!cur_target) {
 			gdb_putpacketz("E01");
@@ -430,7 +531,7 @@ handle_v_packet(char *packet, int plen)
 {
 	unsigned long addr, len;
 	int bin;
-	static uint8_t flash_mode = 0;
+	static SESSION_LOCAL uint8_t flash_mode = 0;
 
 	if (sscanf(packet, "vAttach;%08lx", &addr) == 1) {
 		/* Attach to remote target processor */
@@ -474,9 +575,8 @@ handle_v_packet(char *packet, int plen)
 			target_set_cmdline(cur_target, cmdline);
 			target_reset(cur_target);
 			gdb_putpacketz("T05");
-		} else if(last_target) {
-			cur_target = target_attach(last_target,
-						   &gdb_controller);
+		} else {
+			cur_target = gdb_reattach();
 
 			/* If we were able to attach to the target again */
 			if (cur_target) {
@@ -485,8 +585,7 @@ handle_v_packet(char *packet, int plen)
 				morse(NULL, false);
 				gdb_putpacketz("T05");
 			} else	gdb_putpacketz("E01");
-
-		} else	gdb_putpacketz("E01");
+		}
 
 	} else if (sscanf(packet, "vFlashErase:%08lx,%08lx", &addr, &len) == 2) {
 		/* Erase Flash Memory */
@@ -557,8 +656,16 @@ handle_z_packet(char *packet, int plen)
 	}
 }
 
+void gdb_poll_stats_get(struct gdb_poll_stats *stats)
+{
+	*stats = poll_stats;
+}
+
 void gdb_main(void)
 {
+#if PC_HOSTED == 1
+	session.target_n = gdb_if_session_target();
+#endif
 	crc32_init();
 	gdb_main_loop(&gdb_controller, false);
 }
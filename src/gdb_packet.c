@@ -30,6 +30,21 @@
 
 #include <stdarg.h>
 
+/* Set once GDB has negotiated QStartNoAckMode; packets are then neither
+ * acknowledged by us nor expected to be acknowledged by GDB. */
+static SESSION_LOCAL bool noackmode = false;
+
+void gdb_set_noackmode(bool enable)
+{
+	/* Leaving NoAckMode because a new session started: the packet that
+	 * told us so went unacknowledged, so acknowledge it late. */
+	if (!enable && noackmode)
+		gdb_if_putchar('+', 1);
+	if (noackmode != enable)
+		DEBUG_GDB("%s NoAckMode\n", enable ? "Enabling" : "Disabling");
+	noackmode = enable;
+}
+
 int gdb_getpacket(char *packet, int size)
 {
 	unsigned char c;
@@ -119,9 +134,11 @@ int gdb_getpacket(char *packet, int size)
 		if(csum == strtol(recv_csum, NULL, 16)) break;
 
 		/* get here if checksum fails */
-		gdb_if_putchar('-', 1); /* send nack */
+		if (!noackmode)
+			gdb_if_putchar('-', 1); /* send nack */
 	}
-	gdb_if_putchar('+', 1); /* send ack */
+	if (!noackmode)
+		gdb_if_putchar('+', 1); /* send ack */
 	packet[i] = 0;
 
 #if PC_HOSTED == 1
@@ -172,6 +189,8 @@ void gdb_putpacket(const char *packet, int size)
 		gdb_if_putchar(xmit_csum[0], 0);
 		gdb_if_putchar(xmit_csum[1], 1);
 		DEBUG_GDB_WIRE("\n");
+		if (noackmode)
+			break;
 	} while((gdb_if_getchar_to(2000) != '+') && (tries++ < 3));
 }
 
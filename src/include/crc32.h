@@ -23,4 +23,6 @@
 
 int generic_crc32(target *t, uint32_t *crc, uint32_t base, int len);
 void crc32_init(void);
+/* CRC32 of a host buffer, as generic_crc32() computes it for target memory */
+uint32_t crc32_buffer(const void *buf, size_t len);
 #endif
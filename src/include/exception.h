@@ -58,7 +58,7 @@ struct exception {
 	struct exception *outer;
 };
 
-extern struct exception *innermost_exception;
+extern SESSION_LOCAL struct exception *innermost_exception;
 
 #define TRY_CATCH(e, type_mask) \
 	(e).type = 0; \
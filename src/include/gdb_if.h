@@ -33,5 +33,19 @@ unsigned char gdb_if_getchar_to(int timeout);
 /* sending gdb_if_putchar(0, true) seems to work as keep alive */
 void gdb_if_putchar(unsigned char c, int flush);
 
+#if PC_HOSTED == 1
+/* PC-hosted serves one GDB session per port, each in its own thread.
+ * Probe access is serialised: a session holds the probe lock except
+ * while it waits for its GDB.
+ */
+void gdb_if_probe_lock(void);
+void gdb_if_probe_unlock(void);
+/* Target number bound to the session of the calling thread */
+int gdb_if_session_target(void);
+#else
+# define gdb_if_probe_lock()	do {} while (0)
+# define gdb_if_probe_unlock()	do {} while (0)
+#endif
+
 #endif
 
@@ -21,7 +21,19 @@
 #ifndef __GDB_MAIN_H
 #define __GDB_MAIN_H
 
+#include <stdint.h>
+
+struct gdb_poll_stats {
+	uint32_t total_polls;	/* Halt polls since startup */
+	uint32_t last_polls;	/* Polls while the target last ran */
+	uint32_t last_run_ms;	/* Time the target last ran */
+};
+
+extern unsigned gdb_poll_max_interval;
+
 void gdb_main(void);
+void gdb_session_drop(void);
+void gdb_poll_stats_get(struct gdb_poll_stats *stats);
 
 #endif
 
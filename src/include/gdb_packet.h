@@ -22,11 +22,13 @@
 #define __GDB_PACKET_H
 
 #include <stdarg.h>
+#include <stdbool.h>
 
 int gdb_getpacket(char *packet, int size);
 void gdb_putpacket(const char *packet, int size);
 #define gdb_putpacketz(packet) gdb_putpacket((packet), strlen(packet))
 void gdb_putpacket_f(const char *packet, ...);
+void gdb_set_noackmode(bool enable);
 
 void gdb_out(const char *buf);
 void gdb_voutf(const char *fmt, va_list);
@@ -158,6 +158,14 @@ static inline void DEBUG_WIRE(const char *format, ...)
 }
 #endif
 
+/* PC-hosted runs one GDB session per thread, state belonging to a
+ * session must then be kept per thread. */
+#if PC_HOSTED == 1
+# define SESSION_LOCAL __thread
+#else
+# define SESSION_LOCAL
+#endif
+
 #define ALIGN(x, n) (((x) + (n) - 1) & ~((n) - 1))
 #undef MIN
 #define MIN(x, y)  (((x) < (y)) ? (x) : (y))
@@ -49,6 +49,7 @@ target *target_attach(target *t, struct target_controller *);
 target *target_attach_n(int n, struct target_controller *);
 void target_detach(target *t);
 bool target_attached(target *t);
+void target_release(target *t);
 const char *target_driver_name(target *t);
 const char *target_core_name(target *t);
 unsigned int target_designer(target *t);
@@ -58,10 +59,40 @@ unsigned int target_idcode(target *t);
 bool target_mem_map(target *t, char *buf, size_t len);
 int target_mem_read(target *t, void *dest, target_addr src, size_t len);
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len);
+/* Memory read cache */
+bool target_mem_cache_enable(target *t, bool enable);
+bool target_mem_cache_stats(target *t, uint32_t *hits, uint32_t *misses,
+                            uint32_t *bypassed);
 /* Flash memory access functions */
 int target_flash_erase(target *t, target_addr addr, size_t len);
 int target_flash_write(target *t, target_addr dest, const void *src, size_t len);
 int target_flash_done(target *t);
+/* Incremental flashing: skip erase blocks whose content already matches */
+extern bool target_flash_incremental;
+/* Statistics of the current or last flash session, for each flash region
+ * and summed up for the target. All counters are uint32_t. */
+struct target_flash_stats {
+	uint32_t bytes_requested;	/* Data passed to target_flash_write() */
+	uint32_t bytes_programmed;	/* Data passed to the flash drivers */
+	uint32_t bytes_skipped;		/* Erased-only data not programmed */
+	uint32_t bufs_skipped;		/* ... in that many buffers */
+	uint32_t buf_flushes;		/* Sector buffers written out */
+	uint32_t program_ms;		/* Time spent in driver writes */
+	uint32_t busy_polls;		/* Flash busy status reads */
+	uint32_t crc_ms;		/* Time spent comparing CRCs */
+	uint32_t inc_blocks;		/* Erase blocks checked incrementally */
+	uint32_t inc_skipped;		/* ... of which were unchanged */
+	uint32_t erase_blocks;		/* Erase blocks erased one by one */
+	uint32_t erase_ms;		/* ... and the time it took */
+	uint32_t bank_erases;		/* Bank erases replacing block erases */
+	uint32_t bank_erase_blocks;	/* Erase blocks they covered */
+	uint32_t bank_erase_ms;		/* ... and the time they took */
+};
+const struct target_flash_stats *target_flash_stats(target *t);
+int target_flash_stats_foreach(target *t,
+	void (*cb)(target_addr start, size_t length,
+	           const struct target_flash_stats *stats, void *context),
+	void *context);
 
 /* Register access functions */
 size_t target_regs_size(target *t);
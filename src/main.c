@@ -48,7 +48,12 @@ main(int argc, char **argv)
 		}
 		if (e.type) {
 			gdb_putpacketz("EFF");
+#if PC_HOSTED == 1
+			/* Other session threads keep their targets */
+			gdb_session_drop();
+#else
 			target_list_free();
+#endif
 			morse("TARGET LOST.", 1);
 		}
 	}
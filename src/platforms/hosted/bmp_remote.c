@@ -242,6 +242,60 @@ static void remote_adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 	return;
 }
 
+/* Send queued accesses in as few messages as fit */
+static bool remote_adiv5_transfer(ADIv5_DP_t *dp, struct adiv5_transfer *xfer,
+								  size_t count)
+{
+	char construct[REMOTE_MAX_MSG_SIZE];
+	while (count) {
+		/* Entries follow the header, filled in when the count is known */
+		char *p = construct + REMOTE_TRANSFER_HDR_LEN;
+		size_t reads = 0;
+		size_t n;
+		for (n = 0; (n < count) && (n < REMOTE_TRANSFER_MAX); n++) {
+			/* Entry, value and end of message */
+			if (p + 16 + 2 > construct + REMOTE_MAX_MSG_SIZE)
+				break;
+			uint8_t flags = (xfer[n].RnW ? REMOTE_TRANSFER_RnW : 0) |
+				(xfer[n].ap ? REMOTE_TRANSFER_AP : 0);
+			p += sprintf(p, REMOTE_TRANSFER_ENTRY_STR, flags,
+						 xfer[n].ap ? xfer[n].ap->apsel : 0, xfer[n].addr);
+			if (xfer[n].RnW)
+				reads++;
+			else
+				p += sprintf(p, "%08" PRIx32, xfer[n].value);
+		}
+		char header[REMOTE_TRANSFER_HDR_LEN + 1];
+		snprintf(header, sizeof(header), REMOTE_TRANSFER_STR,
+				 dp->dp_jd_index, (unsigned int)n);
+		memcpy(construct, header, REMOTE_TRANSFER_HDR_LEN);
+		*p++ = REMOTE_EOM;
+		*p   = 0;
+		platform_buffer_write((uint8_t*)construct, p - construct);
+		int s = platform_buffer_read((uint8_t*)construct, REMOTE_MAX_MSG_SIZE);
+		if ((s < 1) || (construct[0] != REMOTE_RESP_OK)) {
+			DEBUG_WARN("%s error %d\n", __func__, s);
+			return true;
+		}
+		/* Eight hex digits per read */
+		if ((size_t)s < 1 + reads * 8) {
+			DEBUG_WARN("%s short response %d for %d reads\n", __func__,
+					   s, (int)reads);
+			return true;
+		}
+		const char *data = &construct[1];
+		for (size_t i = 0; i < n; i++) {
+			if (!xfer[i].RnW)
+				continue;
+			unhexify(xfer[i].result, data, 4);
+			data += 8;
+		}
+		xfer  += n;
+		count -= n;
+	}
+	return false;
+}
+
 #if 0
 static void remote_mem_read(
 	ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
@@ -285,14 +339,18 @@ static void remote_mem_read(
 }
 #endif
 
+/* Bytes per memory read message, the reply carries them as hex */
+#define REMOTE_MEM_READ_BATCH	((REMOTE_MAX_MSG_SIZE - 0x20) / 2)
+
 static void remote_ap_mem_read(
 	ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
-	(void)ap;
 	if (len == 0)
 		return;
+	/* The probe sets up CSW and TAR by itself */
+	adiv5_ap_invalidate(ap);
 	char construct[REMOTE_MAX_MSG_SIZE];
-	int batchsize = (REMOTE_MAX_MSG_SIZE - 0x20) / 2;
+	int batchsize = REMOTE_MEM_READ_BATCH;
 	while(len) {
 		int s;
 		int count = len;
@@ -327,9 +385,9 @@ static void remote_ap_mem_write_sized(
 	ADIv5_AP_t *ap, uint32_t dest, const void *src, size_t len,
 	enum align align)
 {
-	(void)ap;
 	if (len == 0)
 		return;
+	adiv5_ap_invalidate(ap);
 	char construct[REMOTE_MAX_MSG_SIZE];
 	/* (5 * 1 (char)) + (2 * 2 (bytes)) + (3 * 8 (words)) */
 	int batchsize = (REMOTE_MAX_MSG_SIZE - 0x30) / 2;
@@ -372,18 +430,22 @@ void remote_adiv5_dp_defaults(ADIv5_DP_t *dp)
 					 REMOTE_HL_CHECK_STR);
 	platform_buffer_write(construct, s);
 	s = platform_buffer_read(construct, REMOTE_MAX_MSG_SIZE);
-	if ((!s) || (construct[0] == REMOTE_RESP_ERR) ||
-		((construct[1] - '0') <  REMOTE_HL_VERSION)) {
+	int hl_version = construct[1] - '0';
+	if ((!s) || (construct[0] == REMOTE_RESP_ERR) || (hl_version < 1)) {
 		DEBUG_WARN(
 			"Please update BMP firmware for substantial speed increase!\n");
 		return;
 	}
+	if (hl_version >= 2)
+		dp->transfer = remote_adiv5_transfer;
 	dp->low_access = remote_adiv5_low_access;
 	dp->dp_read    = remote_adiv5_dp_read;
 	dp->ap_write   = remote_adiv5_ap_write;
 	dp->ap_read    = remote_adiv5_ap_read;
 	dp->mem_read   = remote_ap_mem_read;
 	dp->mem_write_sized = remote_ap_mem_write_sized;
+	/* One message, the reader rounds up to a multiple of it */
+	dp->mem_read_size = REMOTE_MEM_READ_BATCH;
 }
 
 void remote_add_jtag_dev(int i, const jtag_dev_t *jtag_dev)
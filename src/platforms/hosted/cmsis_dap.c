@@ -259,10 +259,11 @@ static void dap_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 	/* One word transfer for every byte/halfword/word
 	 * Total number of bytes in transfer*/
 	unsigned int max_size = (dbg_get_report_size() - 5) >> (2 - align);
+	uint32_t page = adiv5_ap_tar_page(ap);
 	while (len) {
 		dap_ap_mem_access_setup(ap, src, align);
 		/* Calculate length until next access setup is needed */
-		unsigned int blocksize = (src | 0x3ff) - src + 1;
+		unsigned int blocksize = (src | (page - 1)) - src + 1;
 		if (blocksize > len)
 			blocksize = len;
 		while (blocksize) {
@@ -296,9 +297,10 @@ static void dap_mem_write_sized(
 	if (((unsigned)(1 << align)) == len)
 		return dap_write_single(ap, dest, src, align);
 	unsigned int max_size = (dbg_get_report_size() - 5) >> (2 - align);
+	uint32_t page = adiv5_ap_tar_page(ap);
 	while (len) {
 		dap_ap_mem_access_setup(ap, dest, align);
-		unsigned int blocksize = (dest | 0x3ff) - dest + 1;
+		unsigned int blocksize = (dest | (page - 1)) - dest + 1;
 		if (blocksize > len)
 			blocksize = len;
 		while (blocksize) {
@@ -329,6 +331,9 @@ void dap_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	dp->ap_write = dap_ap_write;
 	dp->mem_read = dap_mem_read;
 	dp->mem_write_sized =  dap_mem_write_sized;
+	dp->transfer = dap_transfer;
+	/* dap_mem_read() sets up TAR again every 1 KiB */
+	dp->mem_read_size = 0x4000;
 }
 
 static void cmsis_dap_jtagtap_reset(void)
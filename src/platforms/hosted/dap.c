@@ -391,11 +391,109 @@ void dap_write_reg(ADIv5_DP_t *dp, uint8_t reg, uint32_t data)
 	}
 }
 
+//-----------------------------------------------------------------------------
+/* Add a SELECT write to a DAP_Transfer request unless SELECT already holds
+ * this value. Returns the number of transfers added. */
+static unsigned int dap_select(ADIv5_DP_t *dp, uint8_t **p, uint32_t select)
+{
+	if (adiv5_dp_select_valid(dp, select))
+		return 0;
+	uint8_t *q = *p;
+	*q++ = SWD_DP_W_SELECT;
+	*q++ = (select >>  0) & 0xff;
+	*q++ = (select >>  8) & 0xff;
+	*q++ = (select >> 16) & 0xff;
+	*q++ = (select >> 24) & 0xff;
+	*p = q;
+	adiv5_dp_select_shadow(dp, select);
+	return 1;
+}
+
+/* Run queued accesses in as few DAP_Transfer commands as the packet size
+ * allows. AP accesses get their SELECT write in front if needed.*/
+bool dap_transfer(ADIv5_DP_t *dp, struct adiv5_transfer *xfer, size_t count)
+{
+	uint8_t buf[1024];
+	/* Queue entry of each DAP transfer in the packet */
+	size_t entry[255];
+	/* Keep request and response within one packet */
+	size_t max_size = dbg_get_report_size() - 5;
+	size_t done = 0;
+	while (done < count) {
+		uint8_t *p = buf + 3;
+		unsigned int transfers = 0;
+		size_t reads = 0;
+		size_t n;
+		for (n = done; n < count; n++) {
+			size_t req_size = (xfer[n].ap ? 5 : 0) + (xfer[n].RnW ? 1 : 5);
+			if (((size_t)(p - buf) + req_size > max_size) ||
+				(2 + (reads + xfer[n].RnW) * 4 > max_size) ||
+				(transfers + 2 > 255))
+				break;
+			if (xfer[n].ap) {
+				uint32_t select = ((uint32_t)xfer[n].ap->apsel << 24) |
+					(xfer[n].addr & 0xF0);
+				if (dap_select(dp, &p, select))
+					entry[transfers++] = n;
+			} else if (!xfer[n].RnW && (xfer[n].addr == ADIV5_DP_SELECT)) {
+				adiv5_dp_select_shadow(dp, xfer[n].value);
+			}
+			*p++ = (xfer[n].addr & 0x0c) |
+				((xfer[n].addr & ADIV5_APnDP) ? DAP_TRANSFER_APnDP : 0) |
+				(xfer[n].RnW ? DAP_TRANSFER_RnW : 0);
+			if (xfer[n].RnW) {
+				reads++;
+			} else {
+				*p++ = (xfer[n].value >>  0) & 0xff;
+				*p++ = (xfer[n].value >>  8) & 0xff;
+				*p++ = (xfer[n].value >> 16) & 0xff;
+				*p++ = (xfer[n].value >> 24) & 0xff;
+			}
+			entry[transfers++] = n;
+		}
+		buf[0] = ID_DAP_TRANSFER;
+		buf[1] = dp->dp_jd_index;
+		buf[2] = transfers;
+		dbg_dap_cmd(buf, sizeof(buf), p - buf);
+		/* Transfers done, last ACK, then the data of all reads done */
+		unsigned int transferred = buf[0];
+		uint8_t *data = &buf[2];
+		for (unsigned int i = 0; (i < transferred) && (i < transfers); i++) {
+			struct adiv5_transfer *x = &xfer[entry[i]];
+			bool select = x->ap && ((i + 1 < transfers) &&
+									(entry[i + 1] == entry[i]));
+			if (select || !x->RnW)
+				continue;
+			*x->result = ((uint32_t)data[3] << 24) |
+				((uint32_t)data[2] << 16) | ((uint32_t)data[1] << 8) | data[0];
+			data += 4;
+		}
+		if (transferred >= transfers) {
+			done = n;
+			continue;
+		}
+		if (buf[1] == DAP_TRANSFER_WAIT) {
+			/* Retry from the access that did not complete. SELECT may
+			 * not hold what this packet wrote to it. */
+			dp->select_valid = false;
+			done = entry[transferred];
+			continue;
+		}
+		DEBUG_WARN("dap_transfer %d of %d: %s\n", transferred, transfers,
+				   (buf[1] == DAP_TRANSFER_ERROR) ? "protocoll error" : "fault");
+		if (buf[1] == DAP_TRANSFER_ERROR)
+			dap_line_reset();
+		return true;
+	}
+	return false;
+}
+
 unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
 							size_t len, enum align align)
 {
 	uint8_t buf[1024];
 	unsigned int sz = len >> align;
+	uint32_t end = src + (sz << MIN(align, ALIGN_WORD));
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
     buf[0] = ID_DAP_TRANSFER_BLOCK;
@@ -409,9 +507,10 @@ unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
 		DEBUG_WARN("dap_read_block @ %08" PRIx32 " fault -> line reset\n", src);
 		dap_line_reset();
 	}
-	if (sz != transferred) {
+	if (sz != transferred)
 		return 1;
-	} else if (align > ALIGN_HALFWORD) {
+	adiv5_ap_tar_advance(ap, end);
+	if (align > ALIGN_HALFWORD) {
 		memcpy(dest, &buf[3], len);
 	} else {
 		uint32_t *p = (uint32_t *)&buf[3];
@@ -430,6 +529,7 @@ unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 {
 	uint8_t buf[1024];
 	unsigned int sz = len >> align;
+	uint32_t end = dest + (sz << MIN(align, ALIGN_WORD));
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
     buf[0] = ID_DAP_TRANSFER_BLOCK;
@@ -460,6 +560,7 @@ unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	if (buf[2] > DAP_TRANSFER_FAULT) {
 		dap_line_reset();
 	}
+	adiv5_ap_tar_advance(ap, end);
 	return (buf[2] > DAP_TRANSFER_WAIT) ? 1 : 0;
 }
 
@@ -532,24 +633,32 @@ static uint8_t *mem_access_setup(ADIv5_AP_t *ap, uint8_t *p,
 	}
 	uint8_t dap_index = 0;
 	dap_index = ap->dp->dp_jd_index;
+	uint8_t *start = p;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 3; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = ADIV5_AP_CSW & 0xF0;
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
-	*p++ = SWD_AP_CSW;
-	*p++ = (csw >>  0) & 0xff;
-	*p++ = (csw >>  8) & 0xff;
-	*p++ = (csw >> 16) & 0xff;
-	*p++ = (csw >> 24) & 0xff;
-	*p++ = SWD_AP_TAR ;
-	*p++ = (addr >>  0) & 0xff;
-	*p++ = (addr >>  8) & 0xff;
-	*p++ = (addr >> 16) & 0xff;
-	*p++ = (addr >> 24) & 0xff;
+	p++; /* Nr transfers */
+	/* The DRW accesses that follow need this AP selected */
+	unsigned int transfers = dap_select(ap->dp, &p,
+										(uint32_t)ap->apsel << 24);
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_CSW, csw)) {
+		*p++ = SWD_AP_CSW;
+		*p++ = (csw >>  0) & 0xff;
+		*p++ = (csw >>  8) & 0xff;
+		*p++ = (csw >> 16) & 0xff;
+		*p++ = (csw >> 24) & 0xff;
+		adiv5_ap_shadow(ap, ADIV5_AP_CSW, csw);
+		transfers++;
+	}
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_TAR, addr)) {
+		*p++ = SWD_AP_TAR ;
+		*p++ = (addr >>  0) & 0xff;
+		*p++ = (addr >>  8) & 0xff;
+		*p++ = (addr >> 16) & 0xff;
+		*p++ = (addr >> 24) & 0xff;
+		adiv5_ap_shadow(ap, ADIV5_AP_TAR, addr);
+		transfers++;
+	}
+	start[2] = transfers;
 	return p;
 }
 
@@ -557,7 +666,11 @@ void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 {
 	uint8_t buf[63];
 	uint8_t *p = mem_access_setup(ap, buf, addr, align);
+	if (!buf[2])
+		return;
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	if (buf[1] != DAP_TRANSFER_OK)
+		adiv5_dp_invalidate(ap->dp);
 }
 
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr)
@@ -569,12 +682,9 @@ uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 	dap_index = ap->dp->dp_jd_index;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 2; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = (addr & 0xF0);
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
+	p++; /* Nr transfers */
+	buf[2] = 1 + dap_select(ap->dp, &p, ((uint32_t)ap->apsel << 24) |
+							(addr & 0xF0));
 	*p++ = (addr & 0x0c) | DAP_TRANSFER_RnW  |
 		((addr & 0x100) ?  DAP_TRANSFER_APnDP : 0);
 	uint32_t res = wait_word(buf, 63, p - buf, &ap->dp->fault);
@@ -589,18 +699,17 @@ void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 	dap_index = ap->dp->dp_jd_index;
 	*p++ = ID_DAP_TRANSFER;
 	*p++ = dap_index;
-	*p++ = 2; /* Nr transfers */
-	*p++ = SWD_DP_W_SELECT;
-	*p++ = (addr & 0xF0);
-	*p++ = 0;
-	*p++ = 0;
-	*p++ = ap->apsel & 0xff;
+	p++; /* Nr transfers */
+	buf[2] = 1 + dap_select(ap->dp, &p, ((uint32_t)ap->apsel << 24) |
+							(addr & 0xF0));
 	*p++ = (addr & 0x0c) | ((addr & 0x100) ?  DAP_TRANSFER_APnDP : 0);
 	*p++ = (value >>  0) & 0xff;
 	*p++ = (value >>  8) & 0xff;
 	*p++ = (value >> 16) & 0xff;
 	*p++ = (value >> 24) & 0xff;
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	if (buf[1] != DAP_TRANSFER_OK)
+		adiv5_dp_invalidate(ap->dp);
 }
 
 void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align)
@@ -608,9 +717,10 @@ void dap_read_single(ADIv5_AP_t *ap, void *dest, uint32_t src, enum align align)
 	uint8_t buf[63];
 	uint8_t *p = mem_access_setup(ap, buf, src, align);
 	*p++ = SWD_AP_DRW | DAP_TRANSFER_RnW;
-	buf[2] = 4;
+	buf[2]++;
 	uint32_t tmp = wait_word(buf, 63, p - buf, &ap->dp->fault);
 	dest = extract(dest, src, tmp, align);
+	adiv5_ap_tar_advance(ap, src + (1 << MIN(align, ALIGN_WORD)));
 }
 
 void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
@@ -637,8 +747,11 @@ void dap_write_single(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 	*p++ = (tmp >>  8) & 0xff;
 	*p++ = (tmp >> 16) & 0xff;
 	*p++ = (tmp >> 24) & 0xff;
-	buf[2] = 4;
+	buf[2]++;
+	adiv5_ap_tar_advance(ap, dest + (1 << MIN(align, ALIGN_WORD)));
 	dbg_dap_cmd(buf, sizeof(buf), p - buf);
+	if (buf[1] != DAP_TRANSFER_OK)
+		adiv5_dp_invalidate(ap->dp);
 }
 
 void dap_jtagtap_tdi_tdo_seq(uint8_t *DO, bool final_tms, const uint8_t *TMS,
@@ -80,6 +80,7 @@ unsigned int dap_read_block(ADIv5_AP_t *ap, void *dest, uint32_t src,
 							size_t len,	enum align align);
 unsigned int dap_write_block(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 							 size_t len, enum align align);
+bool dap_transfer(ADIv5_DP_t *dp, struct adiv5_transfer *xfer, size_t count);
 void dap_ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align);
 uint32_t dap_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 void dap_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
@@ -465,6 +465,10 @@ void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 		fprintf(stderr, " 0x%08" PRIx32 "\n", value);
 	}
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
+	if (addr == ADIV5_DP_SELECT)
+		adiv5_dp_select_shadow(dp, value);
+	else if (addr == ADIV5_DP_ABORT)
+		adiv5_dp_invalidate(dp);
 }
 
 uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
@@ -479,6 +483,7 @@ uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_dp_invalidate(dp);
 	uint32_t ret = dp->error(dp);
 	DEBUG_TARGET( "DP Error 0x%08" PRIx32 "\n", ret);
 	return ret;
@@ -511,7 +516,9 @@ void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 		ap_decode_access(addr, ADIV5_LOW_WRITE);
 		fprintf(stderr, " 0x%08" PRIx32 "\n", value);
 	}
-	return ap->dp->ap_write(ap, addr, value);
+	/* Before the write, so that a failing write can drop the shadow */
+	adiv5_ap_shadow(ap, addr, value);
+	ap->dp->ap_write(ap, addr, value);
 }
 
 void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
@@ -554,5 +561,95 @@ void adiv5_mem_write_sized(	ADIv5_AP_t *ap, uint32_t dest, const void *src,
 void adiv5_dp_abort(struct ADIv5_DP_s *dp, uint32_t abort)
 {
 	DEBUG_TARGET("Abort: %08" PRIx32 "\n", abort);
+	adiv5_dp_invalidate(dp);
 	return dp->abort(dp, abort);
 }
+
+/* Queued accesses are sent to the probe in one batch where the backend
+ * can, so a sequence of register accesses costs one round trip instead of
+ * one per access. Reads deliver their result only after the flush. */
+static void adiv5_queue_add(ADIv5_DP_t *dp, ADIv5_AP_t *ap, uint8_t RnW,
+							uint16_t addr, uint32_t value, uint32_t *result)
+{
+	if (dp->queue_len == ADIV5_QUEUE_SIZE)
+		adiv5_queue_flush(dp);
+	struct adiv5_transfer *xfer = &dp->queue[dp->queue_len++];
+	xfer->ap = ap;
+	xfer->addr = addr;
+	xfer->RnW = RnW;
+	xfer->value = value;
+	xfer->result = result;
+}
+
+void adiv5_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
+{
+	adiv5_queue_add(dp, NULL, ADIV5_LOW_WRITE, addr, value, NULL);
+}
+
+void adiv5_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result)
+{
+	adiv5_queue_add(dp, NULL, ADIV5_LOW_READ, addr, 0, result);
+}
+
+void adiv5_queue_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
+{
+	adiv5_queue_add(ap->dp, ap, ADIV5_LOW_WRITE, addr, value, NULL);
+	adiv5_ap_shadow(ap, addr, value);
+}
+
+void adiv5_queue_ap_read(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result)
+{
+	adiv5_queue_add(ap->dp, ap, ADIV5_LOW_READ, addr, 0, result);
+}
+
+static void adiv5_queue_run(ADIv5_DP_t *dp, struct adiv5_transfer *xfer,
+							size_t count)
+{
+	/* Bit banging probes can overlap consecutive AP reads */
+	bool posted = (dp->ap_read == firmware_ap_read);
+	for (; count--; xfer++) {
+		if (posted && xfer->RnW && xfer->ap) {
+			firmware_ap_read_posted(xfer->ap, xfer->addr, xfer->result);
+			continue;
+		}
+		if (posted && xfer->RnW && (xfer->addr & ADIV5_APnDP)) {
+			firmware_read_posted(dp, xfer->addr, xfer->result);
+			continue;
+		}
+		firmware_posted_finish(dp);
+		if (xfer->ap && xfer->RnW)
+			*xfer->result = dp->ap_read(xfer->ap, xfer->addr);
+		else if (xfer->ap)
+			dp->ap_write(xfer->ap, xfer->addr, xfer->value);
+		else if (xfer->RnW)
+			*xfer->result = dp->dp_read(dp, xfer->addr);
+		else
+			dp->low_access(dp, ADIV5_LOW_WRITE, xfer->addr, xfer->value);
+		if (!xfer->ap && !xfer->RnW && (xfer->addr == ADIV5_DP_SELECT))
+			adiv5_dp_select_shadow(dp, xfer->value);
+	}
+	firmware_posted_finish(dp);
+}
+
+int adiv5_queue_flush(ADIv5_DP_t *dp)
+{
+	size_t count = dp->queue_len;
+	if (!count)
+		return dp->fault ? -1 : 0;
+	dp->queue_len = 0;
+	if (dp->transfer) {
+		if (dp->transfer(dp, dp->queue, count))
+			dp->fault = 1;
+	} else {
+		adiv5_queue_run(dp, dp->queue, count);
+	}
+	if (cl_debuglevel & BMP_DEBUG_TARGET) {
+		for (size_t i = 0; i < count; i++) {
+			struct adiv5_transfer *xfer = &dp->queue[i];
+			ap_decode_access(xfer->addr, xfer->RnW);
+			fprintf(stderr, " 0x%08" PRIx32 "\n",
+					(xfer->RnW) ? *xfer->result : xfer->value);
+		}
+	}
+	return dp->fault ? -1 : 0;
+}
@@ -829,6 +829,8 @@ static void stlink_readmem(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 {
 	if (len == 0)
 		return;
+	/* The adapter sets up CSW and TAR by itself */
+	adiv5_ap_invalidate(ap);
 	size_t read_len = len;
 	uint8_t type;
 	if (src & 1 || len & 1) {
@@ -925,6 +927,7 @@ static void stlink_regs_read(ADIv5_AP_t *ap, void *data)
 					   ap->apsel};
 	uint8_t res[88];
 	DEBUG_PROBE("AP %d: Read all core registers\n", ap->apsel);
+	adiv5_ap_invalidate(ap);
 	send_recv(info.usb_link, cmd, 16, res, 88);
 	stlink_usb_error_check(res, true);
 	memcpy(data, res + 4, 84);
@@ -936,6 +939,7 @@ static uint32_t stlink_reg_read(ADIv5_AP_t *ap, int num)
 					   ap->apsel};
 	uint8_t res[8];
 	send_recv(info.usb_link, cmd, 16, res, 8);
+	adiv5_ap_invalidate(ap);
 	stlink_usb_error_check(res, true);
 	uint32_t ret = res[0] | res[1] << 8 | res[2] << 16 | res[3] << 24;
 	DEBUG_PROBE("AP %d: Read reg %02" PRId32 " val 0x%08" PRIx32 "\n",
@@ -951,6 +955,7 @@ static void stlink_reg_write(ADIv5_AP_t *ap, int num, uint32_t val)
 		(val >> 24) & 0xff, ap->apsel};
 	uint8_t res[2];
 	send_recv(info.usb_link, cmd, 16, res, 2);
+	adiv5_ap_invalidate(ap);
 	DEBUG_PROBE("AP %d: Write reg %02" PRId32 " val 0x%08" PRIx32 "\n",
 				 ap->apsel, num, val);
 	stlink_usb_error_check(res, true);
@@ -962,6 +967,7 @@ static void stlink_mem_write_sized(	ADIv5_AP_t *ap, uint32_t dest,
 {
 	if (len == 0)
 		return;
+	adiv5_ap_invalidate(ap);
 	usb_link_t *link = info.usb_link;
 	switch(align) {
 	case ALIGN_BYTE:
@@ -1037,6 +1043,8 @@ void stlink_adiv5_dp_defaults(ADIv5_DP_t *dp)
 	dp->ap_read = stlink_ap_read;
 	dp->mem_read = stlink_readmem;
 	dp->mem_write_sized = stlink_mem_write_sized;
+	/* One READMEM_32BIT command */
+	dp->mem_read_size = 0x1000;
 }
 
 int stlink_enter_debug_swd(bmp_info_t *info, ADIv5_DP_t *dp)
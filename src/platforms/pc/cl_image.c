@@ -0,0 +1,381 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file splits the image given on the command line into segments, so
+ * that only the flash behind real data is erased and programmed.
+ *
+ * ELF images are loaded by their PT_LOAD program headers at the physical
+ * (load) address, pointing into the mapped file. Intel HEX and Motorola
+ * SREC files are decoded line by line into one buffer. Anything else is
+ * a flat binary placed at the given base address.
+ */
+
+#include "general.h"
+#include "cl_image.h"
+
+#define ELF_HEADER_SIZE 52
+#define ELF_PHDR_SIZE 32
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define PT_LOAD 1
+
+/* Bytes in the longest Intel HEX or SREC record */
+#define RECORD_MAX 260
+
+struct image_builder {
+	struct cl_image *image;
+	size_t seg_alloc;
+	size_t buf_alloc;
+	size_t buf_used;
+};
+
+static uint32_t elf_read16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t elf_read32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool is_elf(const uint8_t *data, size_t size)
+{
+	return (size >= ELF_HEADER_SIZE) && !memcmp(data, "\x7f" "ELF", 4);
+}
+
+enum cl_image_format cl_image_format_from_name(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	if (!ext)
+		return CL_IMAGE_BINARY;
+	if (!strcasecmp(ext, ".hex") || !strcasecmp(ext, ".ihex"))
+		return CL_IMAGE_IHEX;
+	if (!strcasecmp(ext, ".srec") || !strcasecmp(ext, ".s19") ||
+	    !strcasecmp(ext, ".s28") || !strcasecmp(ext, ".s37") ||
+	    !strcasecmp(ext, ".mot"))
+		return CL_IMAGE_SREC;
+	if (!strcasecmp(ext, ".elf"))
+		return CL_IMAGE_ELF;
+	return CL_IMAGE_BINARY;
+}
+
+const char *cl_image_format_name(enum cl_image_format format)
+{
+	switch (format) {
+	case CL_IMAGE_ELF:
+		return "ELF";
+	case CL_IMAGE_IHEX:
+		return "Intel HEX";
+	case CL_IMAGE_SREC:
+		return "SREC";
+	default:
+		return "binary";
+	}
+}
+
+static bool image_add_segment(struct image_builder *b, uint32_t addr,
+                              const uint8_t *data)
+{
+	struct cl_image *image = b->image;
+	if (image->nseg == b->seg_alloc) {
+		size_t seg_alloc = b->seg_alloc ? b->seg_alloc * 2 : 16;
+		struct cl_segment *seg = realloc(image->seg, seg_alloc * sizeof(*seg));
+		if (!seg) {
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return false;
+		}
+		image->seg = seg;
+		b->seg_alloc = seg_alloc;
+	}
+	image->seg[image->nseg].addr = addr;
+	image->seg[image->nseg].size = 0;
+	image->seg[image->nseg].data = data;
+	image->nseg++;
+	return true;
+}
+
+/* Append decoded record data, continuing the last segment if contiguous */
+static bool image_add_data(struct image_builder *b, uint32_t addr,
+                           const uint8_t *data, size_t len)
+{
+	struct cl_image *image = b->image;
+	if (!len)
+		return true;
+	struct cl_segment *last = image->nseg ? &image->seg[image->nseg - 1] : NULL;
+	if (!last || (last->addr + last->size != addr)) {
+		/* Data pointers are set once the buffer stops moving */
+		if (!image_add_segment(b, addr, NULL))
+			return false;
+		last = &image->seg[image->nseg - 1];
+	}
+	if (b->buf_used + len > b->buf_alloc) {
+		size_t buf_alloc = b->buf_alloc ? b->buf_alloc * 2 : 0x10000;
+		while (buf_alloc < b->buf_used + len)
+			buf_alloc *= 2;
+		uint8_t *buf = realloc(image->buf, buf_alloc);
+		if (!buf) {
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return false;
+		}
+		image->buf = buf;
+		b->buf_alloc = buf_alloc;
+	}
+	memcpy(image->buf + b->buf_used, data, len);
+	b->buf_used += len;
+	last->size += len;
+	return true;
+}
+
+static int hex_nibble(char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return c - '0';
+	if ((c >= 'a') && (c <= 'f'))
+		return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F'))
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Decode the hex digits of a record, returns the number of bytes or -1 */
+static int hex_decode(const char *line, size_t len, uint8_t *out)
+{
+	if ((len & 1) || (len / 2 > RECORD_MAX))
+		return -1;
+	for (size_t i = 0; i < len; i += 2) {
+		int hi = hex_nibble(line[i]);
+		int lo = hex_nibble(line[i + 1]);
+		if ((hi < 0) || (lo < 0))
+			return -1;
+		out[i / 2] = (hi << 4) | lo;
+	}
+	return len / 2;
+}
+
+/* Return the next line without line ending, NULL at the end of the file */
+static const char *next_line(const char **p, const char *end, size_t *len)
+{
+	while ((*p < end) && ((**p == '\r') || (**p == '\n') ||
+	                      (**p == ' ') || (**p == '\t')))
+		(*p)++;
+	if (*p == end)
+		return NULL;
+	const char *line = *p;
+	while ((*p < end) && (**p != '\r') && (**p != '\n'))
+		(*p)++;
+	*len = *p - line;
+	while (*len && ((line[*len - 1] == ' ') || (line[*len - 1] == '\t')))
+		(*len)--;
+	return line;
+}
+
+static int ihex_parse(struct image_builder *b, const uint8_t *data, size_t size)
+{
+	const char *p = (const char *)data;
+	const char *end = p + size;
+	uint32_t upper = 0;
+	uint8_t rec[RECORD_MAX];
+	size_t len;
+	int lineno = 0;
+	const char *line;
+	while ((line = next_line(&p, end, &len))) {
+		lineno++;
+		int n = (line[0] == ':') ? hex_decode(line + 1, len - 1, rec) : -1;
+		if ((n < 5) || (rec[0] != n - 5)) {
+			DEBUG_WARN("Intel HEX: Invalid record in line %d\n", lineno);
+			return -1;
+		}
+		uint8_t sum = 0;
+		for (int i = 0; i < n; i++)
+			sum += rec[i];
+		if (sum) {
+			DEBUG_WARN("Intel HEX: Checksum error in line %d\n", lineno);
+			return -1;
+		}
+		uint16_t addr = (rec[1] << 8) | rec[2];
+		switch (rec[3]) {
+		case 0: /* Data */
+			if (!image_add_data(b, upper + addr, rec + 4, rec[0]))
+				return -1;
+			break;
+		case 1: /* End of file */
+			return 0;
+		case 2: /* Extended segment address */
+			if (rec[0] != 2)
+				goto bad_record;
+			upper = ((rec[4] << 8) | rec[5]) << 4;
+			break;
+		case 4: /* Extended linear address */
+			if (rec[0] != 2)
+				goto bad_record;
+			upper = ((uint32_t)rec[4] << 24) | (rec[5] << 16);
+			break;
+		case 3: /* Start segment address */
+		case 5: /* Start linear address */
+			break;
+		default:
+			goto bad_record;
+		}
+	}
+	DEBUG_WARN("Intel HEX: Missing end of file record\n");
+	return -1;
+  bad_record:
+	DEBUG_WARN("Intel HEX: Unsupported record in line %d\n", lineno);
+	return -1;
+}
+
+static int srec_parse(struct image_builder *b, const uint8_t *data, size_t size)
+{
+	/* Address bytes for record types S0 to S9 */
+	static const uint8_t addr_len[10] = {2, 2, 3, 4, 0, 2, 3, 4, 3, 2};
+	const char *p = (const char *)data;
+	const char *end = p + size;
+	uint8_t rec[RECORD_MAX];
+	size_t len;
+	int lineno = 0;
+	const char *line;
+	while ((line = next_line(&p, end, &len))) {
+		lineno++;
+		int type = ((len > 2) && (line[0] == 'S')) ? hex_nibble(line[1]) : -1;
+		int n = ((type >= 0) && (type <= 9) && (type != 4)) ?
+			hex_decode(line + 2, len - 2, rec) : -1;
+		if ((n < 2) || (rec[0] != n - 1) || (rec[0] < addr_len[type] + 1)) {
+			DEBUG_WARN("SREC: Invalid record in line %d\n", lineno);
+			return -1;
+		}
+		uint8_t sum = 0;
+		for (int i = 0; i < n; i++)
+			sum += rec[i];
+		if (sum != 0xff) {
+			DEBUG_WARN("SREC: Checksum error in line %d\n", lineno);
+			return -1;
+		}
+		if ((type < 1) || (type > 3))
+			/* Header, count and start address records */
+			continue;
+		uint32_t addr = 0;
+		for (int i = 0; i < addr_len[type]; i++)
+			addr = (addr << 8) | rec[1 + i];
+		if (!image_add_data(b, addr, rec + 1 + addr_len[type],
+		                    rec[0] - addr_len[type] - 1))
+			return -1;
+	}
+	return 0;
+}
+
+static int elf_parse(struct image_builder *b, const uint8_t *data, size_t size)
+{
+	if ((data[4] != ELFCLASS32) || (data[5] != ELFDATA2LSB)) {
+		DEBUG_WARN("ELF: Only 32-bit little endian files are supported\n");
+		return -1;
+	}
+	uint32_t phoff = elf_read32(data + 28);
+	uint32_t phentsize = elf_read16(data + 42);
+	uint32_t phnum = elf_read16(data + 44);
+	if ((phentsize < ELF_PHDR_SIZE) || (phoff > size) ||
+	    ((size - phoff) / phentsize < phnum)) {
+		DEBUG_WARN("ELF: Invalid program header table\n");
+		return -1;
+	}
+	for (uint32_t i = 0; i < phnum; i++) {
+		const uint8_t *ph = data + phoff + i * phentsize;
+		uint32_t offset = elf_read32(ph + 4);
+		uint32_t paddr = elf_read32(ph + 12);
+		uint32_t filesz = elf_read32(ph + 16);
+		/* Only initialised data is loaded, .bss is cleared at startup */
+		if ((elf_read32(ph) != PT_LOAD) || !filesz)
+			continue;
+		if ((offset > size) || (size - offset < filesz)) {
+			DEBUG_WARN("ELF: Segment %" PRIu32 " exceeds file\n", i);
+			return -1;
+		}
+		if (!image_add_segment(b, paddr, data + offset))
+			return -1;
+		b->image->seg[b->image->nseg - 1].size = filesz;
+	}
+	return 0;
+}
+
+static int segment_compare(const void *a, const void *b)
+{
+	const struct cl_segment *sa = a;
+	const struct cl_segment *sb = b;
+	return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+int cl_image_load(struct cl_image *image, const char *name,
+                  const uint8_t *data, size_t size, uint32_t base)
+{
+	struct image_builder b = {.image = image};
+	memset(image, 0, sizeof(*image));
+	image->format = is_elf(data, size) ? CL_IMAGE_ELF :
+		cl_image_format_from_name(name);
+	int res;
+	switch (image->format) {
+	case CL_IMAGE_ELF:
+		if (!is_elf(data, size)) {
+			DEBUG_WARN("ELF: Invalid file header\n");
+			return -1;
+		}
+		res = elf_parse(&b, data, size);
+		break;
+	case CL_IMAGE_IHEX:
+		res = ihex_parse(&b, data, size);
+		break;
+	case CL_IMAGE_SREC:
+		res = srec_parse(&b, data, size);
+		break;
+	default:
+		res = image_add_segment(&b, base, data) ? 0 : -1;
+		if (!res)
+			image->seg[0].size = size;
+		break;
+	}
+	if (res) {
+		cl_image_free(image);
+		return res;
+	}
+	/* Decoded segments were appended to the buffer in order */
+	size_t offset = 0;
+	for (size_t i = 0; i < image->nseg; i++) {
+		if (!image->seg[i].data) {
+			image->seg[i].data = image->buf + offset;
+			offset += image->seg[i].size;
+		}
+	}
+	qsort(image->seg, image->nseg, sizeof(*image->seg), segment_compare);
+	for (size_t i = 0; i < image->nseg; i++) {
+		image->size += image->seg[i].size;
+		if ((i + 1 < image->nseg) &&
+		    (image->seg[i + 1].addr - image->seg[i].addr < image->seg[i].size)) {
+			DEBUG_WARN("%s: Data at 0x%08" PRIx32 " given twice\n",
+			           cl_image_format_name(image->format),
+			           image->seg[i + 1].addr);
+			cl_image_free(image);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void cl_image_free(struct cl_image *image)
+{
+	free(image->seg);
+	free(image->buf);
+	memset(image, 0, sizeof(*image));
+}
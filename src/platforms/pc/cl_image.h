@@ -0,0 +1,52 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file splits ELF, Intel HEX, SREC and binary images into the
+ * segments the PC-Hosted flash operations work on.
+ */
+#if !defined(__CL_IMAGE_H)
+#define __CL_IMAGE_H
+
+enum cl_image_format {
+	CL_IMAGE_BINARY,
+	CL_IMAGE_ELF,
+	CL_IMAGE_IHEX,
+	CL_IMAGE_SREC,
+};
+
+/* Contiguous run of data to be placed at addr */
+struct cl_segment {
+	uint32_t addr;
+	size_t size;
+	const uint8_t *data;
+};
+
+struct cl_image {
+	enum cl_image_format format;
+	struct cl_segment *seg;	/* Sorted by address, not overlapping */
+	size_t nseg;
+	size_t size;		/* Sum of all segment sizes */
+	uint8_t *buf;		/* Data decoded from text formats */
+};
+
+int cl_image_load(struct cl_image *image, const char *name,
+                  const uint8_t *data, size_t size, uint32_t base);
+void cl_image_free(struct cl_image *image);
+enum cl_image_format cl_image_format_from_name(const char *name);
+const char *cl_image_format_name(enum cl_image_format format);
+
+#endif
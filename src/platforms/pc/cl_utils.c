@@ -28,12 +28,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "version.h"
 #include "target_internal.h"
 #include "cortexm.h"
 #include "command.h"
+#include "crc32.h"
 
 #include "cl_utils.h"
+#include "cl_image.h"
 #include "bmp_hosted.h"
 
 #ifndef O_BINARY
@@ -69,6 +72,7 @@ struct mmap_data {
 };
 int cl_debuglevel;
 static struct mmap_data map; /* Portable way way to nullify the struct!*/
+static struct cl_image image;
 
 
 static int bmp_mmap(char *file, struct mmap_data *map)
@@ -160,10 +164,12 @@ static void cl_help(char **argv)
 	DEBUG_WARN("\t-e\t\t: Assume \"resistor SWD connection\" on FTDI: TDI\n"
                "\t\t\t  connected to TMS, TDO to TDI with eventual resistor\n");
 	DEBUG_WARN("\t-E\t\t: Erase flash until flash end or for given size\n");
-	DEBUG_WARN("\t-w\t\t: Write binary file to target flash (default).\n");
-	DEBUG_WARN("\t-V\t\t: Verify flash against binary file. Can be combined\n"
+	DEBUG_WARN("\t-w\t\t: Write file to target flash (default).\n");
+	DEBUG_WARN("\t-V\t\t: Verify flash against file. Can be combined\n"
 	           "\t\t\t  with -w to verify right after programming.\n");
-	DEBUG_WARN("\t-r\t\t: Read flash and write to binary file\n");
+	DEBUG_WARN("\t-r\t\t: Read flash and write to binary file, or to an\n"
+	           "\t\t\t  Intel HEX file without erased records if the\n"
+	           "\t\t\t  file name ends in .hex\n");
 	DEBUG_WARN("\t-p\t\t: Supplies power to the target (where applicable)\n");
 	DEBUG_WARN("\t-R[h]\t\t: Reset device. Default via SWJ or by hardware(h)\n");
 	DEBUG_WARN("\t-H\t\t: Do not use high level commands (BMP-Remote)\n");
@@ -175,7 +181,18 @@ static void cl_help(char **argv)
 	DEBUG_WARN("\t-a <addr>\t: Start flash operation at flash address <addr>\n"
 		"\t\t\t  Default start is start of flash in memory map\n");
 	DEBUG_WARN("\t-S <num>\t: Read <num> bytes. Default is until read fails.\n");
-	DEBUG_WARN("\t <file>\t\t: Use (binary) file <file> for flash operation\n");
+	DEBUG_WARN("\t-i\t\t: Incremental flashing, only erase and program\n"
+	           "\t\t\t  blocks that changed. Also for GDB loads.\n");
+	DEBUG_WARN("\t-k\t\t: Verify by CRC32 of each block, computed on the\n"
+	           "\t\t\t  target where possible. Only blocks that differ\n"
+	           "\t\t\t  are read back.\n");
+	DEBUG_WARN("\t-O\t\t: Print flash statistics as JSON to stdout after\n"
+	           "\t\t\t  erase or write\n");
+	DEBUG_WARN("\t <file>\t\t: Use file <file> for flash operation. ELF, Intel\n"
+	           "\t\t\t  HEX (.hex) and SREC (.srec, .s19, .s28, .s37)\n"
+	           "\t\t\t  files are written at their own addresses and only\n"
+	           "\t\t\t  erase the blocks they cover. Anything else is a\n"
+	           "\t\t\t  binary written at -a.\n");
 	exit(0);
 }
 
@@ -186,7 +203,7 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 	opt->opt_flash_size = 0xffffffff;
 	opt->opt_flash_start = 0xffffffff;
 	opt->opt_max_swj_frequency = 4000000;
-	while((c = getopt(argc, argv, "eEhHv:d:f:s:I:c:Cln:m:M:wVtTa:S:jpP:rR::")) != -1) {
+	while((c = getopt(argc, argv, "eEhHikOv:d:f:s:I:c:Cln:m:M:wVtTa:S:jpP:rR::")) != -1) {
 		switch(c) {
 		case 'c':
 			if (optarg)
@@ -199,6 +216,15 @@ void cl_init(BMP_CL_OPTIONS_t *opt, int argc, char **argv)
 		case 'H':
 			opt->opt_no_hl = true;
 			break;
+		case 'i':
+			target_flash_incremental = true;
+			break;
+		case 'O':
+			opt->opt_flash_stats = true;
+			break;
+		case 'k':
+			opt->opt_verify_crc = true;
+			break;
 		case 'v':
 			if (optarg)
 				cl_debuglevel = strtol(optarg, NULL, 0) & (BMP_DEBUG_MAX - 1);
@@ -349,6 +375,338 @@ static void display_target(int i, target *t, void *context)
 	}
 }
 
+static void print_flash_stats(const struct target_flash_stats *stats)
+{
+	printf("\"bytes_requested\":%" PRIu32 ",\"bytes_programmed\":%" PRIu32
+	       ",\"bytes_skipped\":%" PRIu32 ",\"bufs_skipped\":%" PRIu32
+	       ",\"buf_flushes\":%" PRIu32 ",\"program_ms\":%" PRIu32
+	       ",\"busy_polls\":%" PRIu32 ",\"crc_ms\":%" PRIu32
+	       ",\"inc_blocks\":%" PRIu32 ",\"inc_skipped\":%" PRIu32
+	       ",\"erase_blocks\":%" PRIu32 ",\"erase_ms\":%" PRIu32
+	       ",\"bank_erases\":%" PRIu32 ",\"bank_erase_blocks\":%" PRIu32
+	       ",\"bank_erase_ms\":%" PRIu32,
+	       stats->bytes_requested, stats->bytes_programmed,
+	       stats->bytes_skipped, stats->bufs_skipped, stats->buf_flushes,
+	       stats->program_ms, stats->busy_polls, stats->crc_ms,
+	       stats->inc_blocks, stats->inc_skipped, stats->erase_blocks,
+	       stats->erase_ms, stats->bank_erases, stats->bank_erase_blocks,
+	       stats->bank_erase_ms);
+}
+
+static void print_flash_region_stats(target_addr start, size_t length,
+                                     const struct target_flash_stats *stats,
+                                     void *context)
+{
+	int *n = context;
+	printf("%s{\"start\":%" PRIu32 ",\"length\":%" PRIu32 ",",
+	       (*n)++ ? "," : "", start, (uint32_t)length);
+	print_flash_stats(stats);
+	printf("}");
+}
+
+/* One JSON object per line for scripts comparing probes and targets */
+static void cl_flash_stats(target *t, const char *operation, uint32_t ms)
+{
+	int n = 0;
+	printf("{\"operation\":\"%s\",\"target\":\"%s\",\"ms\":%" PRIu32 ",",
+	       operation, target_driver_name(t), ms);
+	print_flash_stats(target_flash_stats(t));
+	printf(",\"regions\":[");
+	target_flash_stats_foreach(t, print_flash_region_stats, &n);
+	printf("]}\n");
+	fflush(stdout);
+}
+
+#define WORKSIZE 0x1000
+/* Bytes per CRC compare, one run of the target CRC stub */
+#define VERIFY_CRC_BLOCK 0x10000
+
+/* Compare the CRC32 of each block of flash with the file and only read
+ * back blocks that differ, to find the first difference. */
+static int cl_verify_crc(target *t, uint32_t addr, const uint8_t *data,
+                         size_t size)
+{
+	uint8_t *buf = alloca(WORKSIZE);
+	while (size) {
+		size_t blocksize = MIN(size, VERIFY_CRC_BLOCK);
+		uint32_t crc;
+		if (generic_crc32(t, &crc, addr, blocksize)) {
+			DEBUG_WARN("CRC failed at flash address 0x%08" PRIx32 "\n",
+			           addr);
+			return -1;
+		}
+		if (crc != crc32_buffer(data, blocksize)) {
+			size_t i;
+			for (i = 0; i < blocksize; i += WORKSIZE) {
+				size_t worksize = MIN(blocksize - i, WORKSIZE);
+				if (target_mem_read(t, buf, addr + i, worksize)) {
+					DEBUG_WARN("Read failed at flash address 0x%08"
+					           PRIx32 "\n", (uint32_t)(addr + i));
+					return -1;
+				}
+				if (memcmp(buf, data + i, worksize))
+					break;
+			}
+			if (i >= blocksize) {
+				/* Flash reads back fine, the CRC itself is off */
+				DEBUG_WARN("CRC mismatch but readback matches for flash "
+				           "region 0x%08" PRIx32 " - 0x%08" PRIx32 "\n",
+				           addr, (uint32_t)(addr + blocksize - 1));
+				return -1;
+			}
+			DEBUG_WARN("Verify failed at flash region 0x%08" PRIx32
+			           "\n", (uint32_t)(addr + i));
+			return -1;
+		}
+		addr += blocksize;
+		data += blocksize;
+		size -= blocksize;
+	}
+	return 0;
+}
+
+/* Compare flash with the file by reading it back */
+static int cl_verify_read(target *t, uint32_t addr, const uint8_t *data,
+                          size_t size)
+{
+	uint8_t *buf = alloca(WORKSIZE);
+	while (size) {
+		size_t worksize = MIN(size, WORKSIZE);
+		if (target_mem_read(t, buf, addr, worksize)) {
+			DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
+			           addr);
+			return -1;
+		}
+		if (memcmp(buf, data, worksize)) {
+			DEBUG_WARN("Verify failed at flash region 0x%08" PRIx32 "\n",
+			           addr);
+			return -1;
+		}
+		addr += worksize;
+		data += worksize;
+		size -= worksize;
+	}
+	return 0;
+}
+
+/* Drop segments outside flash, e.g. RAM only ELF segments */
+static void cl_image_flash_only(target *t, struct cl_image *img)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < img->nseg; i++) {
+		struct cl_segment *seg = &img->seg[i];
+		struct target_flash *f;
+		for (f = t->flash; f; f = f->next)
+			if ((f->start <= seg->addr) &&
+			    (seg->addr - f->start < f->length))
+				break;
+		if (!f) {
+			DEBUG_WARN("Skipping %zu bytes at 0x%08" PRIx32
+			           " outside flash\n", seg->size, seg->addr);
+			img->size -= seg->size;
+			continue;
+		}
+		img->seg[n++] = *seg;
+	}
+	img->nseg = n;
+}
+
+/* Flash readout runs as a pipeline: the probe reads into one buffer while
+ * a writer thread writes out the buffers read before. */
+#define READ_BUFS 4
+#define READ_MAX_SIZE 0x10000
+/* Data bytes per Intel HEX record */
+#define IHEX_RECORD 32
+
+struct cl_read_pipe {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd;
+	bool ihex;
+	uint32_t ihex_upper;
+	uint8_t *buf[READ_BUFS];
+	uint32_t addr[READ_BUFS];
+	size_t len[READ_BUFS];
+	uint8_t erased[READ_BUFS];
+	unsigned int head;	/* Buffers filled by the reader */
+	unsigned int tail;	/* Buffers written out */
+	bool done;
+	bool failed;
+};
+
+/* Read in multiples of what the probe transfers best */
+static size_t cl_read_size(target *t)
+{
+	size_t size = 0;
+	if (t->cpuid)	/* Only Cortex-M targets have an ADIv5 AP here */
+		size = cortexm_ap(t)->dp->mem_read_size;
+	if (!size)
+		return WORKSIZE;
+	if (size >= READ_MAX_SIZE)
+		return size;
+	return (READ_MAX_SIZE / size) * size;
+}
+
+static bool ihex_write_record(int fd, uint8_t type, uint16_t addr,
+                              const uint8_t *data, size_t len)
+{
+	char line[1 + 2 * (4 + IHEX_RECORD + 1) + 2];
+	uint8_t sum = len + (addr >> 8) + (addr & 0xff) + type;
+	int n = sprintf(line, ":%02X%04X%02X", (unsigned)len, addr, type);
+	for (size_t i = 0; i < len; i++) {
+		n += sprintf(line + n, "%02X", data[i]);
+		sum += data[i];
+	}
+	n += sprintf(line + n, "%02X\n", (uint8_t)-sum);
+	return write(fd, line, n) == n;
+}
+
+/* Write a buffer as Intel HEX, leaving out records only holding the erased
+ * value, so an almost empty flash gives an almost empty file. */
+static bool ihex_write(struct cl_read_pipe *p, uint32_t addr,
+                       const uint8_t *data, size_t len, uint8_t erased)
+{
+	while (len) {
+		size_t n = MIN(len, IHEX_RECORD - (addr % IHEX_RECORD));
+		bool blank = true;
+		for (size_t i = 0; i < n; i++)
+			if (data[i] != erased)
+				blank = false;
+		if (!blank) {
+			if ((addr >> 16) != p->ihex_upper) {
+				uint8_t upper[2] = {addr >> 24, addr >> 16};
+				if (!ihex_write_record(p->fd, 4, 0, upper, 2))
+					return false;
+				p->ihex_upper = addr >> 16;
+			}
+			if (!ihex_write_record(p->fd, 0, addr & 0xffff, data, n))
+				return false;
+		}
+		addr += n;
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void *cl_read_writer(void *arg)
+{
+	struct cl_read_pipe *p = arg;
+	pthread_mutex_lock(&p->lock);
+	while (true) {
+		while ((p->head == p->tail) && !p->done)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->head == p->tail)
+			break;
+		unsigned int i = p->tail % READ_BUFS;
+		pthread_mutex_unlock(&p->lock);
+		bool ok;
+		if (p->ihex)
+			ok = ihex_write(p, p->addr[i], p->buf[i], p->len[i],
+			                p->erased[i]);
+		else
+			ok = write(p->fd, p->buf[i], p->len[i]) == (ssize_t)p->len[i];
+		pthread_mutex_lock(&p->lock);
+		if (!ok)
+			p->failed = true;
+		p->tail++;
+		pthread_cond_signal(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+
+static uint8_t cl_erased_value(target *t, uint32_t addr)
+{
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		if ((f->start <= addr) && (addr < f->start + f->length))
+			return f->erased;
+	return 0xff;
+}
+
+static bool cl_is_ihex(const char *name)
+{
+	return cl_image_format_from_name(name) == CL_IMAGE_IHEX;
+}
+
+static int cl_flash_read(target *t, BMP_CL_OPTIONS_t *opt, int fd)
+{
+	struct cl_read_pipe p = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.fd = fd,
+		.ihex = cl_is_ihex(opt->opt_flash_file),
+		.ihex_upper = 0,
+	};
+	size_t read_size = cl_read_size(t);
+	uint8_t *data = malloc(READ_BUFS * read_size);
+	if (!data) {			/* malloc failed: heap exhaustion */
+		DEBUG_WARN("malloc: failed in %s\n", __func__);
+		return -1;
+	}
+	for (int i = 0; i < READ_BUFS; i++)
+		p.buf[i] = data + i * read_size;
+	pthread_t writer;
+	if (pthread_create(&writer, NULL, cl_read_writer, &p)) {
+		DEBUG_WARN("Can not start flash file writer\n");
+		free(data);
+		return -1;
+	}
+	DEBUG_INFO("Reading in chunks of %zu bytes%s\n", read_size,
+	           p.ihex ? ", skipping erased records" : "");
+	int res = -1;
+	uint32_t flash_src = opt->opt_flash_start;
+	size_t size = opt->opt_flash_size;
+	size_t bytes_read = 0;
+	uint32_t start_time = platform_time_ms();
+	while (size) {
+		size_t worksize = MIN(size, read_size);
+		pthread_mutex_lock(&p.lock);
+		while ((p.head - p.tail == READ_BUFS) && !p.failed)
+			pthread_cond_wait(&p.cond, &p.lock);
+		bool failed = p.failed;
+		pthread_mutex_unlock(&p.lock);
+		if (failed) {
+			DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
+				   flash_src);
+			break;
+		}
+		unsigned int i = p.head % READ_BUFS;
+		if (target_mem_read(t, p.buf[i], flash_src, worksize)) {
+			DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
+				   flash_src);
+			break;
+		}
+		p.addr[i] = flash_src;
+		p.len[i] = worksize;
+		p.erased[i] = cl_erased_value(t, flash_src);
+		pthread_mutex_lock(&p.lock);
+		p.head++;
+		pthread_cond_signal(&p.cond);
+		pthread_mutex_unlock(&p.lock);
+		bytes_read += worksize;
+		flash_src += worksize;
+		size -= worksize;
+		if (!size)
+			res = 0;
+	}
+	pthread_mutex_lock(&p.lock);
+	p.done = true;
+	pthread_cond_signal(&p.cond);
+	pthread_mutex_unlock(&p.lock);
+	pthread_join(writer, NULL);
+	if (p.failed)
+		res = -1;
+	if (p.ihex && (write(fd, ":00000001FF\n", 12) != 12))
+		res = -1;
+	free(data);
+	uint32_t end_time = platform_time_ms();
+	DEBUG_WARN("Read %s for %zu bytes, %8.3f kiB/s\n",
+	           res ? "failed" : "succeeded", bytes_read,
+	           (((bytes_read * 1.0)/(end_time - start_time))));
+	return res;
+}
+
 int cl_execute(BMP_CL_OPTIONS_t *opt)
 {
 	int res = -1;
@@ -462,6 +820,27 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 			DEBUG_WARN("Can not map file: %s. Aborting!\n", strerror(errno));
 			goto target_detach;
 		}
+		if (cl_image_load(&image, opt->opt_flash_file, map.data, map.size,
+		                  opt->opt_flash_start)) {
+			DEBUG_WARN("Can not parse file %s. Aborting!\n",
+			           opt->opt_flash_file);
+			goto free_map;
+		}
+		if (image.format == CL_IMAGE_BINARY) {
+			if (opt->opt_flash_size < image.size)
+				/* restrict to size given on command line */
+				image.size = image.seg[0].size = opt->opt_flash_size;
+		} else {
+			cl_image_flash_only(t, &image);
+			DEBUG_INFO("%s file with %zu bytes in %zu segments\n",
+			           cl_image_format_name(image.format), image.size,
+			           image.nseg);
+		}
+		if (!image.size) {
+			DEBUG_WARN("No data in file %s. Aborting!\n",
+			           opt->opt_flash_file);
+			goto free_map;
+		}
 	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
 		/* Open as binary */
 		read_file = open(opt->opt_flash_file, O_TRUNC | O_CREAT | O_RDWR | O_BINARY,
@@ -472,16 +851,18 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 			return res;
 		}
 	}
-	if (opt->opt_flash_size < map.size)
-		/* restrict to size given on command line */
-		map.size = opt->opt_flash_size;
 	if (opt->opt_mode == BMP_MODE_RESET) {
 		target_reset(t);
 	} else 	if (opt->opt_mode == BMP_MODE_FLASH_ERASE) {
 		DEBUG_INFO("Erase %zu bytes at 0x%08" PRIx32 "\n", opt->opt_flash_size,
 			  opt->opt_flash_start);
+		uint32_t start_time = platform_time_ms();
 		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
 												 opt->opt_flash_size);
+		/* Deferred erases are carried out on completion */
+		erased |= target_flash_done(t);
+		if (opt->opt_flash_stats)
+			cl_flash_stats(t, "erase", platform_time_ms() - start_time);
 		if (erased) {
 			DEBUG_WARN("Erased failed!\n");
 			goto free_map;
@@ -489,19 +870,28 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 		target_reset(t);
 	} else if ((opt->opt_mode == BMP_MODE_FLASH_WRITE) ||
 	           (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-		DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n", map.size,
-			  opt->opt_flash_start);
 		uint32_t start_time = platform_time_ms();
-		unsigned int erased = target_flash_erase(t, opt->opt_flash_start,
-												 map.size);
+		unsigned int erased = 0;
+		/* Erase all segments before writing any, as neighbouring
+		 * segments may share a block */
+		for (size_t i = 0; (i < image.nseg) && !erased; i++) {
+			DEBUG_INFO("Erase    %zu bytes at 0x%08" PRIx32 "\n",
+			           image.seg[i].size, image.seg[i].addr);
+			erased = target_flash_erase(t, image.seg[i].addr,
+			                            image.seg[i].size);
+		}
 		if (erased) {
 			DEBUG_WARN("Erased failed!\n");
 			goto free_map;
 		} else {
-			DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n",
-				  map.size, opt->opt_flash_start);
-			unsigned int flashed = target_flash_write(t, opt->opt_flash_start,
-													  map.data, map.size);
+			unsigned int flashed = 0;
+			for (size_t i = 0; (i < image.nseg) && !flashed; i++) {
+				DEBUG_INFO("Flashing %zu bytes at 0x%08" PRIx32 "\n",
+				           image.seg[i].size, image.seg[i].addr);
+				flashed = target_flash_write(t, image.seg[i].addr,
+				                             image.seg[i].data,
+				                             image.seg[i].size);
+			}
 			/* Buffered write cares for padding*/
 			if (flashed) {
 				DEBUG_WARN("Flashing failed!\n");
@@ -512,81 +902,53 @@ int cl_execute(BMP_CL_OPTIONS_t *opt)
 		}
 		target_flash_done(t);
 		uint32_t end_time = platform_time_ms();
+		if (opt->opt_flash_stats)
+			cl_flash_stats(t, "write", end_time - start_time);
 		DEBUG_WARN("Flash Write succeeded for %d bytes, %8.3f kiB/s\n",
-			   (int)map.size, (((map.size * 1.0)/(end_time - start_time))));
+			   (int)image.size, (((image.size * 1.0)/(end_time - start_time))));
 		if (opt->opt_mode != BMP_MODE_FLASH_WRITE_VERIFY) {
 			target_reset(t);
 			goto free_map;
 		}
 	}
-	if ((opt->opt_mode == BMP_MODE_FLASH_READ) ||
-	    (opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+	if (opt->opt_verify_crc &&
+	    ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
+	     (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY))) {
+		uint32_t start_time = platform_time_ms();
+		res = 0;
+		for (size_t i = 0; (i < image.nseg) && !res; i++)
+			res = cl_verify_crc(t, image.seg[i].addr, image.seg[i].data,
+			                    image.seg[i].size);
+		uint32_t end_time = platform_time_ms();
+		if (!res)
+			DEBUG_WARN("CRC verify succeeded for %d bytes, %8.3f kiB/s\n",
+			           (int)image.size,
+			           (((image.size * 1.0)/(end_time - start_time))));
+		if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)
+			target_reset(t);
+	} else if (opt->opt_mode == BMP_MODE_FLASH_READ) {
+		DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu"
+			   " bytes to %s\n", opt->opt_flash_start,  opt->opt_flash_size,
+			   opt->opt_flash_file);
+		res = cl_flash_read(t, opt, read_file);
+		close(read_file);
+	} else if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
 	    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-#define WORKSIZE 0x1000
-		uint8_t *data = alloca(WORKSIZE);
-		if (!data) {
-			DEBUG_WARN("Can not malloc memory for flash read/verify "
-					   "operation\n");
-			return res;
-		}
-		if (opt->opt_mode == BMP_MODE_FLASH_READ)
-			DEBUG_INFO("Reading flash from 0x%08" PRIx32 " for %zu"
-				   " bytes to %s\n", opt->opt_flash_start,  opt->opt_flash_size,
-				   opt->opt_flash_file);
-		uint32_t flash_src = opt->opt_flash_start;
-		size_t size = (opt->opt_mode == BMP_MODE_FLASH_READ) ? opt->opt_flash_size:
-			map.size;
-		int bytes_read = 0;
-		void *flash = map.data;
 		uint32_t start_time = platform_time_ms();
-		while (size) {
-			int worksize = (size > WORKSIZE) ? WORKSIZE : size;
-			int n_read = target_mem_read(t, data, flash_src, worksize);
-			if (n_read) {
-				if (opt->opt_flash_size == 0) {/* we reached end of flash */
-					DEBUG_INFO("Reached end of flash at size %" PRId32 "\n",
-						   flash_src - opt->opt_flash_start);
-					break;
-				} else {
-					DEBUG_WARN("Read failed at flash address 0x%08" PRIx32 "\n",
-						   flash_src);
-					break;
-				}
-			} else {
-				bytes_read += worksize;
-			}
-			if ((opt->opt_mode == BMP_MODE_FLASH_VERIFY) ||
-			    (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)) {
-				int difference = memcmp(data, flash, worksize);
-				if (difference){
-					DEBUG_WARN("Verify failed at flash region 0x%08"
-							   PRIx32 "\n", flash_src);
-					return -1;
-				}
-				flash += worksize;
-			} else if (read_file != -1) {
-				int written = write(read_file, data, worksize);
-				if (written < worksize) {
-					DEBUG_WARN("Read failed at flash region 0x%08" PRIx32 "\n",
-						   flash_src);
-					return -1;
-				}
-			}
-			flash_src += worksize;
-			size -= worksize;
-			if (size <= 0)
-				res = 0;
-		}
+		res = 0;
+		for (size_t i = 0; (i < image.nseg) && !res; i++)
+			res = cl_verify_read(t, image.seg[i].addr, image.seg[i].data,
+			                     image.seg[i].size);
 		uint32_t end_time = platform_time_ms();
-		if (read_file != -1)
-			close(read_file);
-		DEBUG_WARN("Read/Verify succeeded for %d bytes, %8.3f kiB/s\n",
-		           bytes_read,
-		           (((bytes_read * 1.0)/(end_time - start_time))));
+		if (!res)
+			DEBUG_WARN("Read/Verify succeeded for %d bytes, %8.3f kiB/s\n",
+			           (int)image.size,
+			           (((image.size * 1.0)/(end_time - start_time))));
 		if (opt->opt_mode == BMP_MODE_FLASH_WRITE_VERIFY)
 			target_reset(t);
 	}
   free_map:
+	cl_image_free(&image);
 	if (map.size)
 		bmp_munmap(&map);
   target_detach:
@@ -48,6 +48,8 @@ typedef struct BMP_CL_OPTIONS_s {
 	bool opt_connect_under_reset;
 	bool external_resistor_swd;
 	bool opt_no_hl;
+	bool opt_flash_stats;
+	bool opt_verify_crc;
 	char *opt_flash_file;
 	char *opt_device;
 	char *opt_serial;
@@ -40,12 +40,69 @@
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "gdb_if.h"
+#include "gdb_main.h"
+#include "gdb_packet.h"
+#include "exception.h"
+#include "morse.h"
+#include "target.h"
 
-static int gdb_if_serv, gdb_if_conn;
+/* Each listening port runs its own GDB session in its own thread,
+ * serving the target with the same index in target_list: the first
+ * port target 1, the second port target 2 and so on.
+ */
+static SESSION_LOCAL int gdb_if_serv, gdb_if_conn;
+static SESSION_LOCAL int gdb_if_session;
 #define DEFAULT_PORT 2000
 #define NUM_GDB_SERVER 4
+
+static pthread_mutex_t gdb_if_probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void gdb_if_probe_lock(void)
+{
+	pthread_mutex_lock(&gdb_if_probe_mutex);
+}
+
+void gdb_if_probe_unlock(void)
+{
+	pthread_mutex_unlock(&gdb_if_probe_mutex);
+}
+
+int gdb_if_session_target(void)
+{
+	return gdb_if_session + 1;
+}
+
+struct gdb_if_listener {
+	int serv;
+	int session;
+};
+
+static void *gdb_if_session_thread(void *arg)
+{
+	struct gdb_if_listener *l = arg;
+	gdb_if_serv = l->serv;
+	gdb_if_session = l->session;
+	free(l);
+
+	gdb_if_probe_lock();
+	while (true) {
+		volatile struct exception e;
+		TRY_CATCH(e, EXCEPTION_ALL) {
+			gdb_main();
+		}
+		if (e.type) {
+			gdb_putpacketz("EFF");
+			/* Other sessions keep their targets */
+			gdb_session_drop();
+			morse("TARGET LOST.", 1);
+		}
+	}
+	return NULL;
+}
+
 int gdb_if_init(void)
 {
 #if defined(_WIN32) || defined(__CYGWIN__)
@@ -59,12 +116,12 @@ int gdb_if_init(void)
 #endif
 	struct sockaddr_in addr;
 	int opt;
-	int port = DEFAULT_PORT - 1;
+	int sessions = 0;
+	int first_serv = -1;
 
-	do {
-		port ++;
-		if (port > DEFAULT_PORT + NUM_GDB_SERVER)
-			return - 1;
+	/* The calling thread runs the first session */
+	gdb_if_probe_lock();
+	for (int port = DEFAULT_PORT; port <= DEFAULT_PORT + NUM_GDB_SERVER; port++) {
 		addr.sin_family = AF_INET;
 		addr.sin_port = htons(port);
 		addr.sin_addr.s_addr = htonl(INADDR_ANY);
@@ -114,17 +171,57 @@ int gdb_if_init(void)
 			close(gdb_if_serv);
 			continue;
 		}
-		break;
-	} while(1);
-	DEBUG_WARN("Listening on TCP: %4d\n", port);
+		DEBUG_WARN("Listening on TCP: %4d for target %d\n", port,
+		           sessions + 1);
+		if (sessions) {
+			struct gdb_if_listener *l = malloc(sizeof(*l));
+			pthread_t thread;
+			if (!l) {		/* malloc failed: heap exhaustion */
+				DEBUG_WARN("malloc: failed in %s\n", __func__);
+				close(gdb_if_serv);
+				break;
+			}
+			l->serv = gdb_if_serv;
+			l->session = sessions;
+			if (pthread_create(&thread, NULL, gdb_if_session_thread, l)) {
+				DEBUG_WARN("Can not start GDB session for port %d\n", port);
+				free(l);
+				close(gdb_if_serv);
+				break;
+			}
+			pthread_detach(thread);
+		} else {
+			first_serv = gdb_if_serv;
+		}
+		sessions++;
+	}
+	if (!sessions)
+		return -1;
+	gdb_if_serv = first_serv;
+	gdb_if_session = 0;
 
 	return 0;
 }
 
 
+/* Receive buffer: recv() fills it in large chunks and gdb_getpacket()
+ * is served from memory, instead of one recv() per character. */
+static SESSION_LOCAL uint8_t gdb_if_rx_buf[0x4000];
+static SESSION_LOCAL size_t gdb_if_rx_head, gdb_if_rx_len;
+
+/* Transmit buffer: grows so a whole packet goes out with one send() */
+static SESSION_LOCAL uint8_t *gdb_if_tx_buf;
+static SESSION_LOCAL size_t gdb_if_tx_size, gdb_if_tx_len;
+
+static void gdb_if_drop_conn(void)
+{
+	gdb_if_conn = -1;
+	gdb_if_rx_head = gdb_if_rx_len = 0;
+	gdb_if_tx_len = 0;
+}
+
 unsigned char gdb_if_getchar(void)
 {
-	unsigned char ret;
 	int i = 0;
 #if defined(_WIN32) || defined(__CYGWIN__)
 	int iResult;
@@ -132,7 +229,7 @@ unsigned char gdb_if_getchar(void)
 #else
 	int flags;
 #endif
-	while(i <= 0) {
+	while(!gdb_if_rx_len) {
 		if(gdb_if_conn <= 0) {
 #if defined(_WIN32) || defined(__CYGWIN__)
 			opt = 1;
@@ -183,9 +280,9 @@ unsigned char gdb_if_getchar(void)
 			fcntl(gdb_if_conn, F_SETFL, flags & ~O_NONBLOCK);
 #endif
 		}
-		i = recv(gdb_if_conn, (void*)&ret, 1, 0);
+		i = recv(gdb_if_conn, (void*)gdb_if_rx_buf, sizeof(gdb_if_rx_buf), 0);
 		if(i <= 0) {
-			gdb_if_conn = -1;
+			gdb_if_drop_conn();
 #if defined(_WIN32) || defined(__CYGWIN__)
 			DEBUG_INFO("Dropped broken connection: %d\n", WSAGetLastError());
 #else
@@ -194,8 +291,11 @@ unsigned char gdb_if_getchar(void)
 			/* Return '+' in case we were waiting for an ACK */
 			return '+';
 		}
+		gdb_if_rx_head = 0;
+		gdb_if_rx_len = i;
 	}
-	return ret;
+	gdb_if_rx_len--;
+	return gdb_if_rx_buf[gdb_if_rx_head++];
 }
 
 unsigned char gdb_if_getchar_to(int timeout)
@@ -207,6 +307,7 @@ unsigned char gdb_if_getchar_to(int timeout)
 	struct timeval tv;
 #endif
 
+	if(gdb_if_rx_len) return gdb_if_getchar();
 	if(gdb_if_conn == -1) return -1;
 
 	tv.tv_sec = timeout / 1000;
@@ -223,17 +324,27 @@ unsigned char gdb_if_getchar_to(int timeout)
 
 void gdb_if_putchar(unsigned char c, int flush)
 {
-#if defined(__WIN32__) || defined(__CYGWIN__)
-	static char buf[2048];
-#else
-	static uint8_t buf[2048];
-#endif
-	static int bufsize = 0;
-	if (gdb_if_conn > 0) {
-		buf[bufsize++] = c;
-		if (flush || (bufsize == sizeof(buf))) {
-			send(gdb_if_conn, buf, bufsize, 0);
-			bufsize = 0;
+	if (gdb_if_conn <= 0)
+		return;
+	if (gdb_if_tx_len == gdb_if_tx_size) {
+		size_t size = gdb_if_tx_size ? gdb_if_tx_size * 2 : 2048;
+		uint8_t *buf = realloc(gdb_if_tx_buf, size);
+		if (buf) {
+			gdb_if_tx_buf = buf;
+			gdb_if_tx_size = size;
+		} else if (gdb_if_tx_buf) {
+			/* Out of memory, fall back to sending what we have */
+			send(gdb_if_conn, (void*)gdb_if_tx_buf, gdb_if_tx_len, 0);
+			gdb_if_tx_len = 0;
+		} else {
+			/* No buffer at all, send unbuffered */
+			send(gdb_if_conn, (void*)&c, 1, 0);
+			return;
 		}
 	}
+	gdb_if_tx_buf[gdb_if_tx_len++] = c;
+	if (flush) {
+		send(gdb_if_conn, (void*)gdb_if_tx_buf, gdb_if_tx_len, 0);
+		gdb_if_tx_len = 0;
+	}
 }
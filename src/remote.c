@@ -139,6 +139,8 @@ void remotePacketProcessSWD(uint8_t i, char *packet)
 	uint32_t param;
 	bool badParity;
 
+	/* Raw sequences leave the DP state unknown to remote_dp */
+	adiv5_dp_invalidate(&remote_dp);
 	switch (packet[1]) {
     case REMOTE_INIT: /* SS = initialise =============================== */
 		if (i==2) {
@@ -191,6 +193,7 @@ void remotePacketProcessJTAG(uint8_t i, char *packet)
 	uint8_t ticks;
 	uint64_t DI;
 	jtag_dev_t jtag_dev;
+	adiv5_dp_invalidate(&remote_dp);
 	switch (packet[1]) {
     case REMOTE_INIT: /* JS = initialise ============================= */
 		remote_dp.dp_read = fw_adiv5_jtagdp_read;
@@ -339,8 +342,13 @@ void remotePacketProcessHL(uint8_t i, char *packet)
 		return;
 	}
 	packet += 2;
-	remote_dp.dp_jd_index = remotehston(2, packet);
+	uint8_t jd_index = remotehston(2, packet);
+	if (jd_index != remote_dp.dp_jd_index) {
+		remote_dp.dp_jd_index = jd_index;
+		adiv5_dp_invalidate(&remote_dp);
+	}
 	packet += 2;
+	memset(&remote_ap, 0, sizeof(remote_ap));
 	remote_ap.apsel = remotehston(2, packet);
 	remote_ap.dp = &remote_dp;
 	switch (index) {
@@ -356,6 +364,8 @@ void remotePacketProcessHL(uint8_t i, char *packet)
 		packet += 4;
 		uint32_t value = remotehston(8, packet);
 		data = remote_dp.low_access(&remote_dp, remote_ap.apsel, addr16, value);
+		if (!remote_ap.apsel)
+			adiv5_dp_invalidate(&remote_dp);
 		_respond_buf(REMOTE_RESP_OK, (uint8_t*)&data, 4);
 		break;
 	case REMOTE_AP_READ: /* Ha = Read from AP register*/
@@ -372,6 +382,48 @@ void remotePacketProcessHL(uint8_t i, char *packet)
 		adiv5_ap_write(&remote_ap, addr16, value);
 		_respond(REMOTE_RESP_OK, 0);
 		break;
+	case REMOTE_TRANSFER: /* HT = Run a batch of DP and AP accesses */
+		packet += 2;
+		uint32_t results[REMOTE_TRANSFER_MAX];
+		unsigned int transfers = remotehston(2, packet);
+		packet += 2;
+		unsigned int reads = 0;
+		unsigned int n;
+		if (transfers > REMOTE_TRANSFER_MAX) {
+			_respond(REMOTE_RESP_ERR, REMOTE_ERROR_WRONGLEN);
+			break;
+		}
+		for (n = 0; (n < transfers) && !remote_dp.fault; n++) {
+			uint8_t flags = remotehston(2, packet);
+			packet += 2;
+			remote_ap.apsel = remotehston(2, packet);
+			packet += 2;
+			addr16 = remotehston(4, packet);
+			packet += 4;
+			if (flags & REMOTE_TRANSFER_RnW) {
+				results[reads++] = (flags & REMOTE_TRANSFER_AP) ?
+					adiv5_ap_read(&remote_ap, addr16) :
+					adiv5_dp_read(&remote_dp, addr16);
+				continue;
+			}
+			value = remotehston(8, packet);
+			packet += 8;
+			if (flags & REMOTE_TRANSFER_AP)
+				adiv5_ap_write(&remote_ap, addr16, value);
+			else
+				adiv5_dp_write(&remote_dp, addr16, value);
+		}
+		if (remote_dp.fault) {
+			/* Errors handles on hosted side.*/
+			_respond(REMOTE_RESP_ERR, n);
+			remote_dp.fault = 0;
+			adiv5_dp_invalidate(&remote_dp);
+		} else if (reads) {
+			_respond_buf(REMOTE_RESP_OK, (uint8_t *)results, reads * 4);
+		} else {
+			_respond(REMOTE_RESP_OK, 0);
+		}
+		break;
 	case REMOTE_AP_MEM_READ: /* HM = Read from Mem and set csw */
 		packet += 2;
 		remote_ap.csw = remotehston(8, packet);
@@ -390,6 +442,7 @@ void remotePacketProcessHL(uint8_t i, char *packet)
 		}
 		_respond(REMOTE_RESP_ERR, 0);
 		remote_ap.dp->fault = 0;
+		adiv5_dp_invalidate(&remote_dp);
 		break;
 	case REMOTE_AP_MEM_WRITE_SIZED: /* Hm = Write to memory and set csw */
 		packet += 2;
@@ -416,6 +469,7 @@ void remotePacketProcessHL(uint8_t i, char *packet)
 			/* Errors handles on hosted side.*/
 			_respond(REMOTE_RESP_ERR, 0);
 			remote_ap.dp->fault = 0;
+			adiv5_dp_invalidate(&remote_dp);
 			break;
 		}
 		_respond(REMOTE_RESP_OK, 0);
@@ -24,7 +24,7 @@
 #include <inttypes.h>
 #include "general.h"
 
-#define REMOTE_HL_VERSION 1
+#define REMOTE_HL_VERSION 2
 
 /*
  * Commands to remote end, and responses
@@ -99,6 +99,15 @@
 #define REMOTE_MEM_READ           'h'
 #define REMOTE_MEM_WRITE_SIZED    'H'
 #define REMOTE_AP_MEM_WRITE_SIZED 'm'
+#define REMOTE_TRANSFER     'T'
+
+/* Batch of DP and AP accesses, HL version 2 and later. The header holds
+ * the entry count after an unused apsel field. Each entry is flags, apsel
+ * and address, followed by the value for writes. The response holds the
+ * results of all reads. */
+#define REMOTE_TRANSFER_MAX   64
+#define REMOTE_TRANSFER_RnW   (1 << 0)
+#define REMOTE_TRANSFER_AP    (1 << 1)
 
 
 /* Generic protocol elements */
@@ -169,6 +178,11 @@
 			'%','0', '2', 'x', '%','0','2','x', '%', '0', '4', 'x', REMOTE_EOM, 0 }
 #define REMOTE_AP_WRITE_STR (char []){ REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_WRITE, \
 			'%','0', '2', 'x', '%','0','2','x', '%', '0', '4', 'x', HEX_U32(csw), REMOTE_EOM, 0 }
+#define REMOTE_TRANSFER_STR (char []){ REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_TRANSFER, \
+			'%','0', '2', 'x', 'f', 'f', '%','0','2','x', 0 }
+#define REMOTE_TRANSFER_HDR_LEN 9
+#define REMOTE_TRANSFER_ENTRY_STR (char []){ '%','0', '2', 'x', '%','0','2','x', \
+			'%', '0', '4', 'x', 0 }
 #define REMOTE_AP_MEM_READ_STR (char []){ REMOTE_SOM, REMOTE_HL_PACKET, REMOTE_AP_MEM_READ, \
 			'%','0', '2', 'x', '%','0','2','x',HEX_U32(csw), HEX_U32(address), HEX_U32(count), \
 			REMOTE_EOM, 0 }
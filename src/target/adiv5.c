@@ -293,11 +293,13 @@ static uint32_t adiv5_mem_read32(ADIv5_AP_t *ap, uint32_t addr)
 
 static uint32_t adiv5_ap_read_id(ADIv5_AP_t *ap, uint32_t addr)
 {
+	uint32_t x[4] = {0};
 	uint32_t res = 0;
-	for (int i = 0; i < 4; i++) {
-		uint32_t x = adiv5_mem_read32(ap, addr + 4 * i);
-		res |= (x & 0xff) << (i * 8);
-	}
+	for (int i = 0; i < 4; i++)
+		adiv5_queue_mem_read32(ap, addr + 4 * i, &x[i]);
+	adiv5_queue_flush(ap->dp);
+	for (int i = 0; i < 4; i++)
+		res |= (x[i] & 0xff) << (i * 8);
 	return res;
 }
 
@@ -324,14 +326,17 @@ static uint32_t cortexm_initial_halt(ADIv5_AP_t *ap)
 	uint32_t dhcsr_valid = CORTEXM_DHCSR_S_HALT | CORTEXM_DHCSR_C_DEBUGEN;
 	uint32_t dhcsr;
 	bool reset_seen = false;
-	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, CORTEXM_DHCSR);
+	adiv5_queue_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+	adiv5_queue_ap_write(ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
 	while (!platform_timeout_is_expired(&to)) {
+		/* One batch per try where the probe can */
 		if (!(ap->dp->idcode & ADIV5_MINDP))
-			adiv5_dp_write(ap->dp, ADIV5_DP_CTRLSTAT,
-						   ctrlstat | (0xfff * ADIV5_DP_CTRLSTAT_TRNCNT));
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, dhcsr_ctl);
-		dhcsr = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
+			adiv5_queue_write(ap->dp, ADIV5_DP_CTRLSTAT,
+							  ctrlstat | (0xfff * ADIV5_DP_CTRLSTAT_TRNCNT));
+		adiv5_queue_write(ap->dp, ADIV5_AP_DRW, dhcsr_ctl);
+		dhcsr = 0xffffffff;
+		adiv5_queue_read(ap->dp, ADIV5_AP_DRW, &dhcsr);
+		adiv5_queue_flush(ap->dp);
 		/* ADIV5_DP_CTRLSTAT_READOK is always set e.g. on STM32F7 even so
 		   CORTEXM_DHCS reads nonsense*/
 		/* On a sleeping STM32F7, invalid DHCSR reads with e.g. 0xffffffff and
@@ -598,6 +603,37 @@ static void adiv5_component_probe(ADIv5_AP_t *ap, uint32_t addr, int recursion,
 	return;
 }
 
+/* Many MEM-APs keep incrementing TAR across more than the guaranteed
+ * 1 kiB. Read the last word in front of each boundary of the ROM table
+ * at BASE and see whether TAR moved on or wrapped. Pages larger than
+ * the 4 kiB ROM table can not be told apart.
+ */
+static uint32_t ap_probe_tar_page(ADIv5_AP_t *ap)
+{
+	uint32_t base = ap->base & ADIV5_AP_BASE_BASEADDR;
+	uint32_t page;
+
+	if (!(ap->base & ADIV5_AP_BASE_PRESENT))
+		return ADIV5_AP_TAR_PAGE;
+	uint32_t csw = adiv5_ap_read(ap, ADIV5_AP_CSW);
+	adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE |
+				   ADIV5_AP_CSW_SIZE_WORD);
+	for (page = ADIV5_AP_TAR_PAGE; page < 0x1000; page <<= 1) {
+		adiv5_ap_write(ap, ADIV5_AP_TAR, base + page - 4);
+		adiv5_ap_read(ap, ADIV5_AP_DRW);
+		if (adiv5_ap_read(ap, ADIV5_AP_TAR) != base + page)
+			break;
+	}
+	adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
+	/* The DRW reads moved TAR behind the shadow's back */
+	adiv5_ap_invalidate(ap);
+	if (ap->dp->fault) {
+		adiv5_dp_error(ap->dp);
+		return ADIV5_AP_TAR_PAGE;
+	}
+	return page;
+}
+
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 {
 	ADIv5_AP_t *ap, tmpap;
@@ -627,6 +663,22 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 		return NULL;
 	}
 
+	/* Packed transfers are optional. Without them, AddrInc does not read
+	 * back as packed. */
+	if (ADIV5_AP_IDR_CLASS(tmpap.idr) == ADIV5_AP_IDR_CLASS_MEM) {
+		uint32_t csw = adiv5_ap_read(&tmpap, ADIV5_AP_CSW);
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, tmpap.csw |
+					   ADIV5_AP_CSW_ADDRINC_PACKED | ADIV5_AP_CSW_SIZE_BYTE);
+		tmpap.packed = ((adiv5_ap_read(&tmpap, ADIV5_AP_CSW) &
+						 ADIV5_AP_CSW_ADDRINC_MASK) == ADIV5_AP_CSW_ADDRINC_PACKED);
+		adiv5_ap_write(&tmpap, ADIV5_AP_CSW, csw);
+		if (tmpap.dp->fault) {
+			adiv5_dp_error(tmpap.dp);
+			tmpap.packed = false;
+		}
+		tmpap.tar_page = ap_probe_tar_page(&tmpap);
+	}
+
 	/* It's valid to so create a heap copy */
 	ap = malloc(sizeof(*ap));
 	if (!ap) {			/* malloc failed: heap exhaustion */
@@ -640,8 +692,9 @@ ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel)
 	uint32_t cfg = adiv5_ap_read(ap, ADIV5_AP_CFG);
 	DEBUG_INFO("AP %3d: IDR=%08"PRIx32" CFG=%08"PRIx32" BASE=%08" PRIx32
 			   " CSW=%08"PRIx32, apsel, ap->idr, cfg, ap->base, ap->csw);
-	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 "\n",
-			   (ap->idr >> 4) & 0xf, ap->idr >> 28);
+	DEBUG_INFO(" (AHB-AP var%" PRIx32 " rev%" PRIx32 "%s, page %" PRIx32
+			   ")\n", (ap->idr >> 4) & 0xf, ap->idr >> 28,
+			   ap->packed ? ", packed" : "", adiv5_ap_tar_page(ap));
 #endif
 	adiv5_ap_ref(ap);
 	return ap;
@@ -697,6 +750,7 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 	dp->mem_read = firmware_mem_read;
 	dp->mem_write_sized = firmware_mem_write_sized;
 #endif
+	adiv5_dp_invalidate(dp);
 	volatile struct exception e;
 	TRY_CATCH (e, EXCEPTION_TIMEOUT) {
 		ctrlstat = adiv5_dp_read(dp, ADIV5_DP_CTRLSTAT);
@@ -820,10 +874,14 @@ void adiv5_dp_init(ADIv5_DP_t *dp)
 #define ALIGNOF(x) (((x) & 3) == 0 ? ALIGN_WORD : \
                     (((x) & 1) == 0 ? ALIGN_HALFWORD : ALIGN_BYTE))
 
-/* Program the CSW and TAR for sequencial access at a given width */
-static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
+/* Program the CSW and TAR for sequencial access at a given width. Packed
+ * accesses move a full word of that width per DRW access.
+ */
+static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr,
+								enum align align, bool packed)
 {
-	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE;
+	uint32_t csw = ap->csw | (packed ? ADIV5_AP_CSW_ADDRINC_PACKED :
+							  ADIV5_AP_CSW_ADDRINC_SINGLE);
 
 	switch (align) {
 	case ALIGN_BYTE:
@@ -837,8 +895,43 @@ static void ap_mem_access_setup(ADIv5_AP_t *ap, uint32_t addr, enum align align)
 		csw |= ADIV5_AP_CSW_SIZE_WORD;
 		break;
 	}
-	adiv5_ap_write(ap, ADIV5_AP_CSW, csw);
-	adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+	/* The raw accesses below and in the callers need this AP selected */
+	adiv5_dp_select(ap->dp, (uint32_t)ap->apsel << 24);
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_CSW, csw)) {
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_CSW, csw);
+		adiv5_ap_shadow(ap, ADIV5_AP_CSW, csw);
+	}
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_TAR, addr)) {
+		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR, addr);
+		adiv5_ap_shadow(ap, ADIV5_AP_TAR, addr);
+	}
+}
+
+static void adiv5_queue_mem_setup(ADIv5_AP_t *ap, uint32_t addr)
+{
+	uint32_t csw = ap->csw | ADIV5_AP_CSW_ADDRINC_SINGLE | ADIV5_AP_CSW_SIZE_WORD;
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_CSW, csw))
+		adiv5_queue_ap_write(ap, ADIV5_AP_CSW, csw);
+	if (!adiv5_ap_shadow_valid(ap, ADIV5_AP_TAR, addr))
+		adiv5_queue_ap_write(ap, ADIV5_AP_TAR, addr);
+}
+
+/* Queue a single word access to memory, see adiv5_queue_flush(). CSW
+ * and TAR are only written if they change, so consecutive words cost one
+ * DRW access each.
+ */
+void adiv5_queue_mem_write32(ADIv5_AP_t *ap, uint32_t addr, uint32_t value)
+{
+	adiv5_queue_mem_setup(ap, addr);
+	adiv5_queue_ap_write(ap, ADIV5_AP_DRW, value);
+	adiv5_ap_tar_advance(ap, addr + 4);
+}
+
+void adiv5_queue_mem_read32(ADIv5_AP_t *ap, uint32_t addr, uint32_t *result)
+{
+	adiv5_queue_mem_setup(ap, addr);
+	adiv5_queue_ap_read(ap, ADIV5_AP_DRW, result);
+	adiv5_ap_tar_advance(ap, addr + 4);
 }
 
 /* Extract read data from data lane based on align and src address */
@@ -853,31 +946,50 @@ void * extract(void *dest, uint32_t src, uint32_t val, enum align align)
 		break;
 	case ALIGN_DWORD:
 	case ALIGN_WORD:
-		*(uint32_t *)dest = val;
+		/* dest is unaligned after the head of a packed read */
+		memcpy(dest, &val, sizeof(val));
 		break;
 	}
 	return (uint8_t *)dest + (1 << align);
 }
 
-void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+/* Packed transfers only pay off for bytes and halfwords and need a word
+ * aligned start. Returns the length of the word aligned part of the
+ * access that can use them, *head gets the length in front of it.
+ */
+static size_t ap_mem_packed_len(ADIv5_AP_t *ap, uint32_t addr, size_t len,
+								enum align align, size_t *head)
+{
+	if (!ap->packed || (align >= ALIGN_WORD))
+		return 0;
+	*head = (4 - (addr & 3)) & 3;
+	if (*head >= len)
+		return 0;
+	return (len - *head) & ~3;
+}
+
+static void mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len,
+					 enum align align, bool packed)
 {
 	uint32_t tmp;
 	uint32_t osrc = src;
-	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	uint32_t page = adiv5_ap_tar_page(ap);
+	/* Data lanes and step of each DRW access */
+	enum align lanes = packed ? ALIGN_WORD : align;
 
 	if (len == 0)
 		return;
 
-	len >>= align;
-	ap_mem_access_setup(ap, src, align);
+	len >>= lanes;
+	ap_mem_access_setup(ap, src, align, packed);
 	adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
 	while (--len) {
 		tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_AP_DRW, 0);
-		dest = extract(dest, src, tmp, align);
+		dest = extract(dest, src, tmp, lanes);
 
-		src += (1 << align);
+		src += (1 << lanes);
 		/* Check for 10 bit address overflow */
-		if ((src ^ osrc) & 0xfffffc00) {
+		if ((src ^ osrc) & ~(page - 1)) {
 			osrc = src;
 			adiv5_dp_low_access(ap->dp,
 					ADIV5_LOW_WRITE, ADIV5_AP_TAR, src);
@@ -886,20 +998,43 @@ void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
 		}
 	}
 	tmp = adiv5_dp_low_access(ap->dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
-	extract(dest, src, tmp, align);
+	extract(dest, src, tmp, lanes);
+	adiv5_ap_tar_advance(ap, src + (1 << lanes));
 }
 
-void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
-							size_t len, enum align align)
+void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len)
+{
+	enum align align = MIN(ALIGNOF(src), ALIGNOF(len));
+	size_t head;
+	size_t packed = ap_mem_packed_len(ap, src, len, align, &head);
+
+	if (!packed) {
+		mem_read(ap, dest, src, len, align, false);
+		return;
+	}
+	mem_read(ap, dest, src, head, align, false);
+	mem_read(ap, (uint8_t *)dest + head, src + head, packed, align, true);
+	head += packed;
+	mem_read(ap, (uint8_t *)dest + head, src + head, len - head, align, false);
+}
+
+static void mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							size_t len, enum align align, bool packed)
 {
 	uint32_t odest = dest;
+	uint32_t page = adiv5_ap_tar_page(ap);
+	/* Data lanes and step of each DRW access */
+	enum align lanes = packed ? ALIGN_WORD : align;
 
-	len >>= align;
-	ap_mem_access_setup(ap, dest, align);
+	if (len == 0)
+		return;
+
+	len >>= lanes;
+	ap_mem_access_setup(ap, dest, align, packed);
 	while (len--) {
 		uint32_t tmp = 0;
 		/* Pack data into correct data lane */
-		switch (align) {
+		switch (lanes) {
 		case ALIGN_BYTE:
 			tmp = ((uint32_t)*(uint8_t *)src) << ((dest & 3) << 3);
 			break;
@@ -908,34 +1043,96 @@ void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 			break;
 		case ALIGN_DWORD:
 		case ALIGN_WORD:
-			tmp = *(uint32_t *)src;
+			memcpy(&tmp, src, sizeof(tmp));
 			break;
 		}
-		src = (uint8_t *)src + (1 << align);
-		dest += (1 << align);
+		src = (uint8_t *)src + (1 << lanes);
+		dest += (1 << lanes);
 		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DRW, tmp);
 
 		/* Check for 10 bit address overflow */
-		if ((dest ^ odest) & 0xfffffc00) {
+		if ((dest ^ odest) & ~(page - 1)) {
 			odest = dest;
 			adiv5_dp_low_access(ap->dp,
 					ADIV5_LOW_WRITE, ADIV5_AP_TAR, dest);
 		}
 	}
+	/* TAR only advanced by words for ALIGN_DWORD */
+	if (lanes == ALIGN_DWORD)
+		adiv5_ap_invalidate(ap);
+	else
+		adiv5_ap_tar_advance(ap, dest);
+}
+
+void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
+							size_t len, enum align align)
+{
+	size_t head;
+	size_t packed = ap_mem_packed_len(ap, dest, len, align, &head);
+
+	if (!packed) {
+		mem_write_sized(ap, dest, src, len, align, false);
+		return;
+	}
+	mem_write_sized(ap, dest, src, head, align, false);
+	mem_write_sized(ap, dest + head, (const uint8_t *)src + head, packed,
+					align, true);
+	head += packed;
+	mem_write_sized(ap, dest + head, (const uint8_t *)src + head, len - head,
+					align, false);
+}
+
+/* AP reads are posted: the data returned by one is that of the AP read
+ * before. Back to back AP reads thus cost one transaction each, plus one
+ * RDBUFF read for the last. Any other access in between, including a
+ * SELECT change, must come after firmware_posted_finish(), as a JTAG-DP
+ * hands the posted data to whatever scan follows.
+ */
+void firmware_read_posted(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result)
+{
+	uint32_t data = adiv5_dp_low_access(dp, ADIV5_LOW_READ, addr, 0);
+	if (dp->posted)
+		*dp->posted = data;
+	dp->posted = result;
+}
+
+void firmware_ap_read_posted(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result)
+{
+	uint32_t select = ((uint32_t)ap->apsel << 24) | (addr & 0xF0);
+	if (!adiv5_dp_select_valid(ap->dp, select)) {
+		firmware_posted_finish(ap->dp);
+		adiv5_dp_write(ap->dp, ADIV5_DP_SELECT, select);
+	}
+	firmware_read_posted(ap->dp, addr, result);
+}
+
+/* Collect the last posted read */
+void firmware_posted_finish(ADIv5_DP_t *dp)
+{
+	uint32_t *result = dp->posted;
+	if (!result)
+		return;
+	dp->posted = NULL;
+	*result = adiv5_dp_low_access(dp, ADIV5_LOW_READ, ADIV5_DP_RDBUFF, 0);
+}
+
+/* Write SELECT unless it already holds this value */
+void adiv5_dp_select(ADIv5_DP_t *dp, uint32_t select)
+{
+	if (!adiv5_dp_select_valid(dp, select))
+		adiv5_dp_write(dp, ADIV5_DP_SELECT, select);
 }
 
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT,
-			((uint32_t)ap->apsel << 24)|(addr & 0xF0));
+	adiv5_dp_select(ap->dp, ((uint32_t)ap->apsel << 24)|(addr & 0xF0));
 	adiv5_dp_write(ap->dp, addr, value);
 }
 
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 {
 	uint32_t ret;
-	adiv5_dp_write(ap->dp, ADIV5_DP_SELECT,
-			((uint32_t)ap->apsel << 24)|(addr & 0xF0));
+	adiv5_dp_select(ap->dp, ((uint32_t)ap->apsel << 24)|(addr & 0xF0));
 	ret = adiv5_dp_read(ap->dp, addr);
 	return ret;
 }
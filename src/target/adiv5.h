@@ -89,6 +89,10 @@
 #define ADIV5_AP_BASE		ADIV5_AP_REG(0xF8)
 #define ADIV5_AP_IDR		ADIV5_AP_REG(0xFC)
 
+/* AP Identification Register (IDR) */
+#define ADIV5_AP_IDR_CLASS(x)		(((x) >> 13) & 0xf)
+#define ADIV5_AP_IDR_CLASS_MEM		0x8
+
 /* Known designers seen in SYSROM-PIDR and JTAG IDCode.
  * Ignore Bit 0 from the designer bits to get JEDEC Ids.
  * Should get it's one file as not only related to Adiv5!
@@ -130,6 +134,9 @@
 #define ADIV5_AP_CSW_SIZE_WORD		(2u << 0)
 #define ADIV5_AP_CSW_SIZE_MASK		(7u << 0)
 
+/* TAR auto increment is only guaranteed within this boundary */
+#define ADIV5_AP_TAR_PAGE		0x400
+
 /* AP Debug Base Address Register (BASE) */
 #define ADIV5_AP_BASE_BASEADDR		(0xFFFFF000u)
 #define ADIV5_AP_BASE_PRESENT		(1u << 0)
@@ -159,6 +166,19 @@ enum align {
 
 typedef struct ADIv5_AP_s ADIv5_AP_t;
 
+#if PC_HOSTED == 1
+/* Register accesses queued per DP, see adiv5_queue_flush() */
+#define ADIV5_QUEUE_SIZE 64
+
+struct adiv5_transfer {
+	ADIv5_AP_t *ap;	/* Select this AP first, NULL for DP or raw access */
+	uint16_t addr;
+	uint8_t RnW;
+	uint32_t value;
+	uint32_t *result;	/* Valid after the flush */
+};
+#endif
+
 /* Try to keep this somewhat absract for later adding SW-DP */
 typedef struct ADIv5_DP_s {
 	int refcnt;
@@ -190,6 +210,14 @@ typedef struct ADIv5_DP_s {
 	void (*read_block)(uint32_t addr, uint8_t *data, int size);
 	void (*dap_write_block_sized)(uint32_t addr, uint8_t *data,
 								  int size, enum align align);
+	/* Length of mem_read() the backend transfers best, 0 if unknown */
+	size_t mem_read_size;
+	/* Run queued accesses in one go, returns true on fault. NULL runs
+	 * them one by one. */
+	bool (*transfer)(struct ADIv5_DP_s *dp, struct adiv5_transfer *xfer,
+	                 size_t count);
+	struct adiv5_transfer queue[ADIV5_QUEUE_SIZE];
+	size_t queue_len;
 #endif
 	uint32_t (*ap_read)(ADIv5_AP_t *ap, uint16_t addr);
 	void (*ap_write)(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
@@ -199,6 +227,14 @@ typedef struct ADIv5_DP_s {
 							size_t len, enum align align);
 	uint8_t dp_jd_index;
 	uint8_t fault;
+
+	/* Last value written to SELECT, see adiv5_dp_invalidate() */
+	uint32_t select;
+	bool select_valid;
+	/* AP register shadows taken in an older epoch are stale */
+	uint32_t shadow_epoch;
+	/* Destination of the posted AP read still in flight */
+	uint32_t *posted;
 } ADIv5_DP_t;
 
 struct ADIv5_AP_s {
@@ -214,10 +250,98 @@ struct ADIv5_AP_s {
 	uint32_t ap_storage; /* E.g to hold STM32F7 initial DBGMCU_CR value.*/
 	uint16_t ap_designer;
 	uint16_t ap_partno;
+	bool packed; /* Supports packed byte and halfword transfers */
+	uint32_t tar_page; /* TAR auto increment boundary, 0 if not probed */
+
+	/* Last values written to CSW and TAR, valid in dp->shadow_epoch */
+	uint32_t csw_shadow;
+	uint32_t tar_shadow;
+	uint32_t csw_epoch;
+	uint32_t tar_epoch;
 };
 
 unsigned int make_packet_request(uint8_t RnW, uint16_t addr);
 
+/* SELECT, CSW and TAR are shadowed so that writes not changing them can
+ * be skipped. After a fault, an abort or a line reset their content is
+ * unknown, so drop all shadows of the DP.
+ */
+static inline void adiv5_dp_invalidate(ADIv5_DP_t *dp)
+{
+	/* The posted read is lost as well */
+	dp->posted = NULL;
+	dp->select_valid = false;
+	if (++dp->shadow_epoch == 0)
+		dp->shadow_epoch = 1;
+}
+
+static inline bool adiv5_dp_select_valid(ADIv5_DP_t *dp, uint32_t select)
+{
+	return dp->select_valid && !dp->fault && (dp->select == select);
+}
+
+static inline void adiv5_dp_select_shadow(ADIv5_DP_t *dp, uint32_t select)
+{
+	dp->select = select;
+	dp->select_valid = true;
+}
+
+static inline void adiv5_ap_invalidate(ADIv5_AP_t *ap)
+{
+	ap->csw_epoch = 0;
+	ap->tar_epoch = 0;
+}
+
+/* True if writing value to AP register addr would change nothing */
+static inline bool adiv5_ap_shadow_valid(ADIv5_AP_t *ap, uint16_t addr,
+                                         uint32_t value)
+{
+	uint32_t epoch = ap->dp->shadow_epoch;
+	if (!epoch || ap->dp->fault)
+		return false;
+	if (addr == ADIV5_AP_CSW)
+		return (ap->csw_epoch == epoch) && (ap->csw_shadow == value);
+	if (addr == ADIV5_AP_TAR)
+		return (ap->tar_epoch == epoch) && (ap->tar_shadow == value);
+	return false;
+}
+
+/* Record a write to AP register addr */
+static inline void adiv5_ap_shadow(ADIv5_AP_t *ap, uint16_t addr,
+                                   uint32_t value)
+{
+	if (addr == ADIV5_AP_CSW) {
+		ap->csw_shadow = value;
+		ap->csw_epoch = ap->dp->shadow_epoch;
+	} else if (addr == ADIV5_AP_TAR) {
+		ap->tar_shadow = value;
+		ap->tar_epoch = ap->dp->shadow_epoch;
+	} else if (addr == ADIV5_AP_DRW) {
+		/* May increment TAR, depending on CSW */
+		ap->tar_epoch = 0;
+	}
+}
+
+static inline uint32_t adiv5_ap_tar_page(ADIv5_AP_t *ap)
+{
+	return ap->tar_page ? ap->tar_page : ADIV5_AP_TAR_PAGE;
+}
+
+/* Record TAR after auto incremented DRW accesses up to end. TAR is
+ * unknown once end reaches the next auto increment boundary.
+ */
+static inline void adiv5_ap_tar_advance(ADIv5_AP_t *ap, uint32_t end)
+{
+	if (end & (adiv5_ap_tar_page(ap) - 1))
+		adiv5_ap_shadow(ap, ADIV5_AP_TAR, end);
+	else
+		ap->tar_epoch = 0;
+}
+
+void firmware_read_posted(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result);
+void firmware_ap_read_posted(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result);
+void firmware_posted_finish(ADIv5_DP_t *dp);
+
 #if PC_HOSTED == 0
 static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 {
@@ -226,6 +350,7 @@ static inline uint32_t adiv5_dp_read(ADIv5_DP_t *dp, uint16_t addr)
 
 static inline uint32_t adiv5_dp_error(ADIv5_DP_t *dp)
 {
+	adiv5_dp_invalidate(dp);
 	return dp->error(dp);
 }
 
@@ -247,7 +372,8 @@ static inline uint32_t adiv5_ap_read(ADIv5_AP_t *ap, uint16_t addr)
 
 static inline void adiv5_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value)
 {
-	return ap->dp->ap_write(ap, addr, value);
+	adiv5_ap_shadow(ap, addr, value);
+	ap->dp->ap_write(ap, addr, value);
 }
 
 static inline void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src,
@@ -266,6 +392,51 @@ static inline void adiv5_mem_write_sized(
 static inline void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value)
 {
 	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
+	if (addr == ADIV5_DP_SELECT)
+		adiv5_dp_select_shadow(dp, value);
+	else if (addr == ADIV5_DP_ABORT)
+		adiv5_dp_invalidate(dp);
+}
+
+/* On the probe itself queued accesses run at once. Only AP reads are
+ * held back, as posted reads, until another kind of access follows.
+ */
+static inline void adiv5_queue_write(ADIv5_DP_t *dp, uint16_t addr,
+                                     uint32_t value)
+{
+	firmware_posted_finish(dp);
+	dp->low_access(dp, ADIV5_LOW_WRITE, addr, value);
+}
+
+static inline void adiv5_queue_read(ADIv5_DP_t *dp, uint16_t addr,
+                                    uint32_t *result)
+{
+	if (addr & ADIV5_APnDP) {
+		firmware_read_posted(dp, addr, result);
+		return;
+	}
+	firmware_posted_finish(dp);
+	*result = dp->dp_read(dp, addr);
+}
+
+static inline void adiv5_queue_ap_write(ADIv5_AP_t *ap, uint16_t addr,
+                                        uint32_t value)
+{
+	firmware_posted_finish(ap->dp);
+	adiv5_ap_shadow(ap, addr, value);
+	ap->dp->ap_write(ap, addr, value);
+}
+
+static inline void adiv5_queue_ap_read(ADIv5_AP_t *ap, uint16_t addr,
+                                       uint32_t *result)
+{
+	firmware_ap_read_posted(ap, addr, result);
+}
+
+static inline int adiv5_queue_flush(ADIv5_DP_t *dp)
+{
+	firmware_posted_finish(dp);
+	return dp->fault ? -1 : 0;
 }
 
 #else
@@ -280,8 +451,16 @@ void adiv5_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src, size_t len);
 void adiv5_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest,
 						   const void *src, size_t len, enum align align);
 void adiv5_dp_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void adiv5_queue_write(ADIv5_DP_t *dp, uint16_t addr, uint32_t value);
+void adiv5_queue_read(ADIv5_DP_t *dp, uint16_t addr, uint32_t *result);
+void adiv5_queue_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
+void adiv5_queue_ap_read(ADIv5_AP_t *ap, uint16_t addr, uint32_t *result);
+int adiv5_queue_flush(ADIv5_DP_t *dp);
 #endif
 
+void adiv5_queue_mem_write32(ADIv5_AP_t *ap, uint32_t addr, uint32_t value);
+void adiv5_queue_mem_read32(ADIv5_AP_t *ap, uint32_t addr, uint32_t *result);
+
 void adiv5_dp_init(ADIv5_DP_t *dp);
 void platform_adiv5_dp_defaults(ADIv5_DP_t *dp);
 ADIv5_AP_t *adiv5_new_ap(ADIv5_DP_t *dp, uint8_t apsel);
@@ -302,6 +481,7 @@ void firmware_mem_write_sized(ADIv5_AP_t *ap, uint32_t dest, const void *src,
 							  size_t len, enum align align);
 void firmware_mem_read(ADIv5_AP_t *ap, void *dest, uint32_t src,
 					   size_t len);
+void adiv5_dp_select(ADIv5_DP_t *dp, uint32_t select);
 void firmware_ap_write(ADIv5_AP_t *ap, uint16_t addr, uint32_t value);
 uint32_t firmware_ap_read(ADIv5_AP_t *ap, uint16_t addr);
 uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
@@ -97,8 +97,10 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 		dp->fault = 1;
 		return 0;
 	}
-	if((ack != JTAGDP_ACK_OK))
+	if((ack != JTAGDP_ACK_OK)) {
+		adiv5_dp_invalidate(dp);
 		raise_exception(EXCEPTION_ERROR, "JTAG-DP invalid ACK");
+	}
 
 	return (uint32_t)(response >> 3);
 }
@@ -106,6 +108,7 @@ uint32_t fw_adiv5_jtagdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 void adiv5_jtagdp_abort(ADIv5_DP_t *dp, uint32_t abort)
 {
 	uint64_t request = (uint64_t)abort << 3;
+	adiv5_dp_invalidate(dp);
 	jtag_dev_write_ir(&jtag_proc, dp->dp_jd_index, IR_ABORT);
 	jtag_dev_shift_dr(&jtag_proc, dp->dp_jd_index, NULL, (const uint8_t*)&request, 35);
 }
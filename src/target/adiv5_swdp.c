@@ -48,6 +48,7 @@ unsigned int make_packet_request(uint8_t RnW, uint16_t addr)
 
 static void dp_line_reset(ADIv5_DP_t *dp)
 {
+	adiv5_dp_invalidate(dp);
 	dp->seq_out(0xFFFFFFFF, 32);
 	dp->seq_out(0x0FFFFFFF, 32);
 }
@@ -256,12 +257,16 @@ uint32_t firmware_swdp_low_access(ADIv5_DP_t *dp, uint8_t RnW,
 		return 0;
 	}
 
-	if(ack != SWDP_ACK_OK)
+	if(ack != SWDP_ACK_OK) {
+		adiv5_dp_invalidate(dp);
 		raise_exception(EXCEPTION_ERROR, "SWDP invalid ACK");
+	}
 
 	if(RnW) {
-		if(dp->seq_in_parity(&response, 32))  /* Give up on parity error */
+		if(dp->seq_in_parity(&response, 32)) { /* Give up on parity error */
+			adiv5_dp_invalidate(dp);
 			raise_exception(EXCEPTION_ERROR, "SWDP Parity error");
+		}
 	} else {
 		dp->seq_out_parity(value, 32);
 		/* ARM Debug Interface Architecture Specification ADIv5.0 to ADIv5.2
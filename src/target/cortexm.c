@@ -580,31 +580,32 @@ static void cortexm_regs_read(target *t, void *data)
 #endif
 	else {
 		/* FIXME: Describe what's really going on here */
-		adiv5_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
+		adiv5_queue_ap_write(ap, ADIV5_AP_CSW, ap->csw | ADIV5_AP_CSW_SIZE_WORD);
 
 		/* Map the banked data registers (0x10-0x1c) to the
 		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR,
-							CORTEXM_DHCSR);
+		adiv5_queue_ap_write(ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
 
 		/* Walk the regnum_cortex_m array, reading the registers it
-		 * calls out. */
-		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[0]);
-       /* Required to switch banks */
-		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
-		for(i = 1; i < sizeof(regnum_cortex_m) / 4; i++) {
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_DB(DB_DCRSR),
-			regnum_cortex_m[i]);
-		*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+		 * calls out. The whole block goes out as one batch, the
+		 * DCRDR reads are posted. */
+		for(i = 0; i < sizeof(regnum_cortex_m) / 4; i++) {
+			adiv5_queue_ap_write(ap, ADIV5_AP_DB(DB_DCRSR), regnum_cortex_m[i]);
+			adiv5_queue_ap_read(ap, ADIV5_AP_DB(DB_DCRDR), regs++);
 		}
 		if (t->target_options & TOPT_FLAVOUR_V7MF)
 			for(i = 0; i < sizeof(regnum_cortex_mf) / 4; i++) {
-				adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE,
-									ADIV5_AP_DB(DB_DCRSR),
-									regnum_cortex_mf[i]);
-				*regs++ = adiv5_dp_read(ap->dp, ADIV5_AP_DB(DB_DCRDR));
+				adiv5_queue_ap_write(ap, ADIV5_AP_DB(DB_DCRSR),
+									 regnum_cortex_mf[i]);
+				adiv5_queue_ap_read(ap, ADIV5_AP_DB(DB_DCRDR), regs++);
 			}
+		if (adiv5_queue_flush(ap->dp)) {
+			/* Don't hand out stale values, the fault stays pending
+			 * for target_check_error() */
+			DEBUG_WARN("cortexm: register read failed\n");
+			memset(data, 0, t->regs_size);
 		}
+	}
 }
 
 static void cortexm_regs_write(target *t, const void *data)
@@ -634,8 +635,7 @@ static void cortexm_regs_write(target *t, const void *data)
 
 		/* Map the banked data registers (0x10-0x1c) to the
 		 * debug registers DHCSR, DCRSR, DCRDR and DEMCR respectively */
-		adiv5_dp_low_access(ap->dp, ADIV5_LOW_WRITE, ADIV5_AP_TAR,
-							CORTEXM_DHCSR);
+		adiv5_ap_write(ap, ADIV5_AP_TAR, CORTEXM_DHCSR);
 		/* Walk the regnum_cortex_m array, writing the registers it
 		 * calls out. */
 		adiv5_ap_write(ap, ADIV5_AP_DB(DB_DCRDR), *regs++);
@@ -768,6 +768,31 @@ static void cortexm_halt_request(target *t)
 	}
 }
 
+/* Read DFSR and, as breakpoints need it, the PC after a halt. Both go
+ * out in one batch. Returns 1 if the PC was read, 0 if it was left out
+ * and -1 if the batch failed. */
+static int cortexm_halt_state_read(target *t, uint32_t *dfsr, uint32_t *pc)
+{
+	ADIv5_AP_t *ap = cortexm_ap(t);
+	*dfsr = 0;
+	*pc = 0;
+#if PC_HOSTED == 1
+	if (ap->dp->ap_reg_read) {
+		/* The probe reads registers by itself, one round trip each */
+		*dfsr = target_mem_read32(t, CORTEXM_DFSR);
+		return 0;
+	}
+#endif
+	adiv5_queue_mem_read32(ap, CORTEXM_DFSR, dfsr);
+	adiv5_queue_mem_write32(ap, CORTEXM_DCRSR, 0x0F);
+	adiv5_queue_mem_read32(ap, CORTEXM_DCRDR, pc);
+	if (adiv5_queue_flush(ap->dp)) {
+		DEBUG_WARN("cortexm: halt state read failed\n");
+		return -1;
+	}
+	return 1;
+}
+
 static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 {
 	struct cortexm_priv *priv = t->priv;
@@ -793,7 +818,11 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 		return TARGET_HALT_RUNNING;
 
 	/* We've halted.  Let's find out why. */
-	uint32_t dfsr = target_mem_read32(t, CORTEXM_DFSR);
+	uint32_t dfsr;
+	uint32_t pc;
+	int pc_valid = cortexm_halt_state_read(t, &dfsr, &pc);
+	if (pc_valid < 0)
+		return TARGET_HALT_ERROR;
 	target_mem_write32(t, CORTEXM_DFSR, dfsr); /* write back to reset */
 
 	if ((dfsr & CORTEXM_DFSR_VCATCH) && cortexm_fault_unwind(t))
@@ -804,7 +833,8 @@ static enum target_halt_reason cortexm_halt_poll(target *t, target_addr *watch)
 	if (priv->on_bkpt) {
 		/* If we've hit a programmed breakpoint, check for semihosting
 		 * call. */
-		uint32_t pc = cortexm_pc_read(t);
+		if (!pc_valid)
+			pc = cortexm_pc_read(t);
 		uint16_t bkpt_instr;
 		bkpt_instr = target_mem_read16(t, pc);
 		if (bkpt_instr == 0xBEAB) {
@@ -916,8 +946,11 @@ static int cortexm_fault_unwind(target *t)
 	return 0;
 }
 
-int cortexm_run_stub(target *t, uint32_t loadaddr,
-                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+/* Load the registers for a stub and let it run. The caller must collect
+ * the result with cortexm_stub_wait(), and may access target memory while
+ * the stub runs. */
+int cortexm_stub_start(target *t, uint32_t loadaddr,
+                       uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
 {
 	uint32_t regs[t->regs_size / 4];
 
@@ -935,15 +968,19 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	if (target_check_error(t))
 		return -1;
 
-	/* Execute the stub */
-	enum target_halt_reason reason;
-#if defined(PLATFORM_HAS_DEBUG)
-	uint32_t arm_regs_start[t->regs_size];
-	target_regs_read(t, arm_regs_start);
-#endif
+	/* The stub may change any memory it likes */
+	target_mem_cache_invalidate(t);
 	cortexm_halt_resume(t, 0);
+	return 0;
+}
+
+/* Wait for a stub started by cortexm_stub_start() to exit, returns the
+ * stub exit code or a negative value on failure. */
+int cortexm_stub_wait(target *t, uint32_t timeout_ms)
+{
+	enum target_halt_reason reason;
 	platform_timeout timeout;
-	platform_timeout_set(&timeout, 5000);
+	platform_timeout_set(&timeout, timeout_ms);
 	do {
 		if (platform_timeout_is_expired(&timeout)) {
 			cortexm_halt_request(t);
@@ -952,8 +989,7 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 			uint32_t arm_regs[t->regs_size];
 			target_regs_read(t, arm_regs);
 			for (unsigned int i = 0; i < 20; i++) {
-				DEBUG_WARN("%2d: %08" PRIx32 ", %08" PRIx32 "\n",
-						   i, arm_regs_start[i], arm_regs[i]);
+				DEBUG_WARN("%2d: %08" PRIx32 "\n", i, arm_regs[i]);
 			}
 #endif
 			return -3;
@@ -975,6 +1011,14 @@ int cortexm_run_stub(target *t, uint32_t loadaddr,
 	return bkpt_instr & 0xff;
 }
 
+int cortexm_run_stub(target *t, uint32_t loadaddr,
+                     uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3)
+{
+	if (cortexm_stub_start(t, loadaddr, r0, r1, r2, r3))
+		return -1;
+	return cortexm_stub_wait(t, 5000);
+}
+
 /* The following routines implement hardware breakpoints and watchpoints.
  * The Flash Patch and Breakpoint (FPB) and Data Watch and Trace (DWT)
  * systems are used. */
@@ -192,6 +192,9 @@ bool cortexm_attach(target *t);
 void cortexm_detach(target *t);
 int cortexm_run_stub(target *t, uint32_t loadaddr,
                      uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_stub_start(target *t, uint32_t loadaddr,
+                       uint32_t r0, uint32_t r1, uint32_t r2, uint32_t r3);
+int cortexm_stub_wait(target *t, uint32_t timeout_ms);
 int cortexm_mem_write_sized(
 	target *t, target_addr dest, const void *src, size_t len, enum align align);
 
@@ -0,0 +1,139 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements a RAM resident flash loader for Cortex-M targets.
+ *
+ * The stub in flashstub/flashloader.s is started once per write and drains
+ * a ring buffer in target RAM into flash, polling the flash status register
+ * on the target. Meanwhile the debugger keeps the ring filled, so a large
+ * write costs little more than transferring the data over the debug link.
+ *
+ * Layout in target RAM: stub, control block, ring.
+ */
+
+#include "general.h"
+#include "target.h"
+#include "target_internal.h"
+#include "cortexm.h"
+#include "flashloader.h"
+
+static const uint16_t flashloader_stub[] = {
+#include "flashstub/flashloader.stub"
+};
+
+#define FL_CTRL_WP		0x00
+#define FL_CTRL_RP		0x04
+#define FL_CTRL_SIZE		0x20
+#define FL_CTRL_OFFSET		ALIGN(sizeof(flashloader_stub), 8)
+#define FL_RING_OFFSET		(FL_CTRL_OFFSET + FL_CTRL_SIZE)
+#if PC_HOSTED == 1
+# define FL_RING_MAX		0x4000
+#else
+# define FL_RING_MAX		0x1000
+#endif
+/* Time the stub may make no progress before it is considered hung */
+#define FL_TIMEOUT		5000
+
+int flashloader_write(struct target_flash *f,
+                      const struct flashloader_prog *prog,
+                      target_addr dest, const void *src, size_t len)
+{
+	target *t = f->t;
+	const uint8_t *data = src;
+
+	/* t->cpuid is only set for Cortex-M cores */
+	if (!t->cpuid || !len || (len % prog->unit))
+		return 1;
+	/* Use RAM in the architectural SRAM region, which is executable */
+	struct target_ram *r;
+	for (r = t->ram; r; r = r->next)
+		if ((r->start >= 0x20000000) && (r->start < 0x40000000) &&
+		    (r->length >= FL_RING_OFFSET + 0x100))
+			break;
+	if (!r)
+		return 1;
+
+	/* The stub programs whole units as soon as the write pointer covers
+	 * them, so only ever publish whole units */
+	uint32_t unit_mask = ~(prog->unit - 1);
+	uint32_t ring_size = MIN(r->length - FL_RING_OFFSET, FL_RING_MAX) &
+	                     ~7 & unit_mask;
+	uint32_t ctrl = r->start + FL_CTRL_OFFSET;
+	uint32_t ring = r->start + FL_RING_OFFSET;
+	uint32_t ring_end = ring + ring_size;
+	uint32_t chunk = (ring_size / 4) & unit_mask;
+	uint32_t ctrl_block[FL_CTRL_SIZE / 4] = {
+		ring, ring, prog->sr, prog->busy, prog->error, prog->unit,
+		ring, ring_end,
+	};
+	if (target_mem_write(t, r->start, flashloader_stub,
+	                     sizeof(flashloader_stub)) ||
+	    target_mem_write(t, ctrl, ctrl_block, sizeof(ctrl_block)))
+		return 1;
+
+	uint32_t start_time = platform_time_ms();
+	if (cortexm_stub_start(t, r->start, ctrl, dest, len, 0))
+		return 1;
+
+	uint32_t wp = ring;
+	uint32_t rp = ring;
+	size_t sent = 0;
+	platform_timeout timeout;
+	platform_timeout_set(&timeout, FL_TIMEOUT);
+	while (sent < len) {
+		/* Keep one unit free so a full ring is not mistaken as empty */
+		uint32_t used = (wp - rp + ring_size) % ring_size;
+		uint32_t space = ring_size - used - prog->unit;
+		uint32_t n = MIN(MIN(space, ring_end - wp), MIN(len - sent, chunk));
+		if (n) {
+			target_mem_write(t, wp, data + sent, n);
+			sent += n;
+			wp += n;
+			if (wp == ring_end)
+				wp = ring;
+			target_mem_write32(t, ctrl + FL_CTRL_WP, wp);
+			if (target_check_error(t)) {
+				DEBUG_WARN("flashloader: comm error\n");
+				target_halt_request(t);
+				return -1;
+			}
+			continue;
+		}
+		uint32_t new_rp = target_mem_read32(t, ctrl + FL_CTRL_RP);
+		f->stats.busy_polls++;
+		if (new_rp != rp) {
+			rp = new_rp;
+			platform_timeout_set(&timeout, FL_TIMEOUT);
+			continue;
+		}
+		/* No progress, the stub may have stopped on a flash error */
+		if ((target_halt_poll(t, NULL) != TARGET_HALT_RUNNING) ||
+		    platform_timeout_is_expired(&timeout))
+			break;
+	}
+	int ret = cortexm_stub_wait(t, FL_TIMEOUT);
+	if (ret) {
+		DEBUG_WARN("flashloader: stub failed (%d), sr 0x%08" PRIx32 "\n",
+		           ret, target_mem_read32(t, prog->sr));
+		return -1;
+	}
+	uint32_t ms = platform_time_ms() - start_time;
+	DEBUG_INFO("flashloader: %" PRIu32 " bytes at 0x%08" PRIx32
+	           " in %" PRIu32 " ms, %" PRIu32 " KB/s\n", (uint32_t)len,
+	           dest, ms, (uint32_t)(len * 1000ULL / 1024 / (ms ? ms : 1)));
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * This file is part of the Black Magic Debug project.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FLASHLOADER_H
+#define __FLASHLOADER_H
+
+#include "target_internal.h"
+
+/* How a flash controller programs one unit, for flashstub/flashloader.s.
+ * The stub writes each unit to flash with a single access of the unit size
+ * (two word accesses for 8 byte units), then waits for the busy bits in the
+ * status register to clear before checking the error bits.
+ */
+struct flashloader_prog {
+	uint32_t sr;
+	uint32_t busy;
+	uint32_t error;
+	uint32_t unit;
+};
+
+/* Program len bytes at dest through the RAM resident loader. The flash
+ * controller must already be set up for programming.
+ * Returns 0 on success, -1 on error and 1 if the loader can not be used
+ * on this target, in which case nothing was written.
+ */
+int flashloader_write(struct target_flash *f,
+                      const struct flashloader_prog *prog,
+                      target_addr dest, const void *src, size_t len);
+
+#endif
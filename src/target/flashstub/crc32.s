@@ -0,0 +1,64 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ CRC32 (polynomial 0x04C11DB7, MSB first, as GDB's qCRC) of target memory
+@ r0: start address
+@ r1: length in bytes
+@ r2: word aligned scratch RAM for the 1 KiB lookup table
+@ r3: CRC to continue from, 0xFFFFFFFF for a new calculation
+@ The result is returned in r0.
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+	.text
+	.global crc32_stub
+	.thumb_func
+crc32_stub:
+	ldr r7, =0x04C11DB7
+	movs r4, #0
+table:
+	lsls r5, r4, #24
+	movs r6, #8
+table_bit:
+	lsls r5, r5, #1
+	bcc table_next
+	eors r5, r7
+table_next:
+	subs r6, #1
+	bne table_bit
+	lsls r6, r4, #2
+	str r5, [r2, r6]
+	adds r4, #1
+	lsrs r6, r4, #8
+	beq table
+
+	adds r1, r0
+	b crc_check
+crc_byte:
+	ldrb r4, [r0]
+	adds r0, #1
+	lsrs r5, r3, #24
+	eors r5, r4
+	lsls r5, r5, #2
+	ldr r5, [r2, r5]
+	lsls r3, r3, #8
+	eors r3, r5
+crc_check:
+	cmp r0, r1
+	bne crc_byte
+	mov r0, r3
+	bkpt #0
+	.align 2
+	.pool
@@ -0,0 +1,88 @@
+@ This file is part of the Black Magic Debug project.
+@
+@ This program is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ This program is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+@ Ring buffer flash loader: programs flash from a ring buffer in target RAM
+@ that the debugger keeps filling while the stub runs.
+@ r0: control block
+@	0x00 write pointer, advanced by the debugger
+@	0x04 read pointer, advanced by the stub
+@	0x08 flash status register address
+@	0x0c status register busy bits
+@	0x10 status register error bits
+@	0x14 program unit in bytes: 1, 2, 4 or 8
+@	0x18 ring start
+@	0x1c ring end
+@ r1: flash destination address
+@ r2: length in bytes, a multiple of the program unit
+@ The flash controller must already be set up for programming.
+@ Exits with 0 on success and 1 on a flash error.
+	.syntax unified
+	.cpu cortex-m0
+	.thumb
+	.text
+	.global flashloader_stub
+	.thumb_func
+flashloader_stub:
+	ldr r3, [r0, #0x04]
+	ldr r5, [r0, #0x14]
+loop:
+	cmp r2, #0
+	beq done
+wait:
+	ldr r4, [r0, #0x00]
+	cmp r4, r3
+	beq wait
+	cmp r5, #1
+	beq byte
+	cmp r5, #2
+	beq half
+	movs r4, #0
+word:
+	ldr r6, [r3, r4]
+	str r6, [r1, r4]
+	adds r4, #4
+	cmp r4, r5
+	bne word
+	b busy
+byte:
+	ldrb r6, [r3]
+	strb r6, [r1]
+	b busy
+half:
+	ldrh r6, [r3]
+	strh r6, [r1]
+busy:
+	ldr r6, [r0, #0x08]
+	ldr r7, [r6]
+	ldr r4, [r0, #0x0c]
+	tst r7, r4
+	bne busy
+	ldr r4, [r0, #0x10]
+	tst r7, r4
+	bne error
+	adds r1, r1, r5
+	subs r2, r2, r5
+	adds r3, r3, r5
+	ldr r4, [r0, #0x1c]
+	cmp r3, r4
+	bne next
+	ldr r3, [r0, #0x18]
+next:
+	str r3, [r0, #0x04]
+	b loop
+done:
+	bkpt #0
+error:
+	bkpt #1
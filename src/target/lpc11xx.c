@@ -74,10 +74,10 @@ const struct command_s lpc11xx_cmd_list[] = {
 
 void lpc11xx_add_flash(target *t, uint32_t addr, size_t len, size_t erasesize, uint32_t iap_entry, uint8_t reserved_pages)
 {
-	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
-	lf->f.blocksize = erasesize;
-	lf->f.buf_size = IAP_PGM_CHUNKSIZE;
+	struct lpc_flash *lf = lpc_add_flash(t, addr, len, erasesize,
+	                                     IAP_PGM_CHUNKSIZE);
 	lf->f.write = lpc_flash_write_magic_vect;
+	lf->f.fixup = lpc_flash_fixup_magic_vect;
 	lf->iap_entry = iap_entry;
 	lf->iap_ram = IAP_RAM_BASE;
 	lf->iap_msp = IAP_RAM_BASE + MIN_RAM_SIZE - RAM_USAGE_FOR_IAP_ROUTINES;
@@ -65,10 +65,9 @@ void lpc43xx_add_flash(target *t, uint32_t iap_entry,
                        uint8_t bank, uint8_t base_sector,
                        uint32_t addr, size_t len, size_t erasesize)
 {
-	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
+	struct lpc_flash *lf = lpc_add_flash(t, addr, len, erasesize,
+	                                     IAP_PGM_CHUNKSIZE);
 	lf->f.erase = lpc43xx_flash_erase;
-	lf->f.blocksize = erasesize;
-	lf->f.buf_size = IAP_PGM_CHUNKSIZE;
 	lf->bank = bank;
 	lf->base_sector = base_sector;
 	lf->iap_entry = iap_entry;
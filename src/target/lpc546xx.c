@@ -80,15 +80,15 @@ void lpc546xx_add_flash(target *t, uint32_t iap_entry,
 			uint8_t base_sector, uint32_t addr,
 			size_t len, size_t erasesize)
 {
-	struct lpc_flash *lf = lpc_add_flash(t, addr, len);
+	struct lpc_flash *lf = lpc_add_flash(t, addr, len, erasesize,
+	                                     IAP_PGM_CHUNKSIZE);
 	lf->f.erase = lpc546xx_flash_erase;
 
 	/* LPC546xx devices require the checksum value written into the vector table
 	in sector 0 */
 	lf->f.write = lpc_flash_write_magic_vect;
+	lf->f.fixup = lpc_flash_fixup_magic_vect;
 
-	lf->f.blocksize = erasesize;
-	lf->f.buf_size = IAP_PGM_CHUNKSIZE;
 	lf->bank = 0;
 	lf->base_sector = base_sector;
 	lf->iap_entry = iap_entry;
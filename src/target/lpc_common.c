@@ -33,6 +33,22 @@ struct flash_param {
 	uint32_t result[4];
 } __attribute__((aligned(4)));
 
+/* An IAP call and the target state to restore once it completed */
+struct lpc_iap_job {
+	bool running;
+	enum iap_cmd cmd;
+	enum iap_status status;
+	struct flash_param backup_param;
+	uint32_t backup_regs[];
+};
+
+/* Copy sizes IAP_CMD_PROGRAM accepts, largest first */
+static const size_t iap_copy_sizes[] = {4096, 1024, 512, 256};
+#define IAP_COPY_SIZES	(sizeof(iap_copy_sizes) / sizeof(iap_copy_sizes[0]))
+
+/* The IAP routines use up to 128 bytes of stack */
+#define IAP_STACK_SIZE	128
+
 char *iap_error[] = {
 	"CMD_SUCCESS",
 	"Invalid command",
@@ -72,30 +88,52 @@ char *iap_error[] = {
 
 static int lpc_flash_write(struct target_flash *tf,
 						   target_addr dest, const void *src, size_t len);
+static int lpc_flash_write_start(struct target_flash *tf,
+                                 target_addr dest, const void *src, size_t len);
+static int lpc_flash_write_poll(struct target_flash *tf);
 
-struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length)
+struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length,
+                                size_t blocksize, size_t max_copy)
 {
-	struct lpc_flash *lf = calloc(1, sizeof(*lf));
+	/* The IAP job with its register backup follows the flash */
+	struct lpc_flash *lf = calloc(1, sizeof(*lf) +
+	                              sizeof(struct lpc_iap_job) + t->regs_size);
 	struct target_flash *f;
 
 	if (!lf) {			/* calloc failed: heap exhaustion */
 		DEBUG_WARN("calloc: failed in %s\n", __func__);
 		return NULL;
 	}
+	lf->iap_job = (struct lpc_iap_job *)(lf + 1);
 
 	f = &lf->f;
 	f->start = addr;
 	f->length = length;
+	f->blocksize = blocksize;
+	/* Program in the largest chunks the IAP RAM allows */
+	f->buf_size = iap_copy_sizes[IAP_COPY_SIZES - 1];
+	for (size_t i = 0; i < IAP_COPY_SIZES; i++) {
+		if ((iap_copy_sizes[i] <= max_copy) &&
+		    (iap_copy_sizes[i] <= blocksize)) {
+			f->buf_size = iap_copy_sizes[i];
+			break;
+		}
+	}
 	f->erase = lpc_flash_erase;
 	f->write = lpc_flash_write;
+	f->write_start = lpc_flash_write_start;
+	f->write_poll = lpc_flash_write_poll;
 	f->erased = 0xff;
 	target_add_flash(t, f);
 	return lf;
 }
 
-enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+/* Start an IAP call, leaving the target running */
+static void lpc_iap_start(struct lpc_flash *f, enum iap_cmd cmd,
+                          const uint32_t words[4])
 {
 	target *t = f->f.t;
+	struct lpc_iap_job *job = f->iap_job;
 	struct flash_param param = {
 		.opcode = ARM_THUMB_BREAKPOINT,
 		.command = cmd,
@@ -106,26 +144,21 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 		f->wdt_kick(t);
 
 	/* save IAP RAM to restore after IAP call */
-	struct flash_param backup_param;
-	target_mem_read(t, &backup_param, f->iap_ram, sizeof(backup_param));
+	target_mem_read(t, &job->backup_param, f->iap_ram,
+	                sizeof(job->backup_param));
 
 	/* save registers to restore after IAP call */
-	uint32_t backup_regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, backup_regs);
+	target_regs_read(t, job->backup_regs);
 
 	/* fill out the remainder of the parameters */
-	va_list ap;
-	va_start(ap, cmd);
-	for (int i = 0; i < 4; i++)
-		param.words[i] = va_arg(ap, uint32_t);
-	va_end(ap);
+	memcpy(param.words, words, sizeof(param.words));
 
 	/* copy the structure to RAM */
 	target_mem_write(t, f->iap_ram, &param, sizeof(param));
 
 	/* set up for the call to the IAP ROM */
 	uint32_t regs[t->regs_size / sizeof(uint32_t)];
-	target_regs_read(t, regs);
+	memcpy(regs, job->backup_regs, t->regs_size);
 	regs[0] = f->iap_ram + offsetof(struct flash_param, command);
 	regs[1] = f->iap_ram + offsetof(struct flash_param, status);
 	regs[REG_MSP] = f->iap_msp;
@@ -133,16 +166,28 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 	regs[REG_PC] = f->iap_entry;
 	target_regs_write(t, regs);
 
-	/* start the target and wait for it to halt again */
+	/* start the target, it halts again at the breakpoint */
+	job->cmd = cmd;
+	job->running = true;
 	target_halt_resume(t, false);
-	while (!target_halt_poll(t, NULL));
+}
+
+/* Collect the result of the IAP call once the target halted */
+static enum iap_status lpc_iap_finish(struct lpc_flash *f, void *result)
+{
+	target *t = f->f.t;
+	struct lpc_iap_job *job = f->iap_job;
+	enum iap_cmd cmd = job->cmd;
+	struct flash_param param;
+
+	job->running = false;
 
 	/* copy back just the parameters structure */
 	target_mem_read(t, &param, f->iap_ram, sizeof(param));
 
 	/* restore the original data in RAM and registers */
-	target_mem_write(t, f->iap_ram, &backup_param, sizeof(param));
-	target_regs_write(t, backup_regs);
+	target_mem_write(t, f->iap_ram, &job->backup_param, sizeof(param));
+	target_regs_write(t, job->backup_regs);
 
 	/* if the user expected a result, set the result (16 bytes). */
 	if (result != NULL)
@@ -162,6 +207,42 @@ enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd
 	return param.status;
 }
 
+/* Returns true while an asynchronous IAP call is running */
+static bool lpc_iap_busy(struct lpc_flash *f)
+{
+	struct lpc_iap_job *job = f->iap_job;
+	if (!job->running)
+		return false;
+	if (!target_halt_poll(f->f.t, NULL))
+		return true;
+	job->status = lpc_iap_finish(f, NULL);
+	return false;
+}
+
+enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...)
+{
+	target *t = f->f.t;
+	uint32_t words[4];
+
+	/* The IAP ROM runs on the target, one call at a time */
+	for (struct target_flash *tf = t->flash; tf; tf = tf->next)
+		if (tf->write_poll == lpc_flash_write_poll)
+			while (lpc_iap_busy((struct lpc_flash *)tf))
+				;
+
+	/* fill out the remainder of the parameters */
+	va_list ap;
+	va_start(ap, cmd);
+	for (int i = 0; i < 4; i++)
+		words[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+
+	/* start the target and wait for it to halt again */
+	lpc_iap_start(f, cmd, words);
+	while (!target_halt_poll(t, NULL));
+	return lpc_iap_finish(f, result);
+}
+
 static uint8_t lpc_sector_for_addr(struct lpc_flash *f, uint32_t addr)
 {
 	return f->base_sector + (addr - f->f.start) / f->f.blocksize;
@@ -244,19 +325,89 @@ static int lpc_flash_write(struct target_flash *tf,
 	return 0;
 }
 
+/* Two IAP buffers follow the parameters in IAP RAM, if they fit below the
+ * IAP stack. One is uploaded while the other is programmed. */
+static uint32_t lpc_iap_buf(struct lpc_flash *f, unsigned window)
+{
+	return ALIGN(f->iap_ram + sizeof(struct flash_param), 4) +
+		window * f->f.buf_size;
+}
+
+static bool lpc_iap_double_buffered(struct lpc_flash *f)
+{
+	return lpc_iap_buf(f, 2) + IAP_STACK_SIZE <= f->iap_msp;
+}
+
+/* The 8th vector holds the two's complement of the sum of the first 7 */
+static uint32_t lpc_magic_vect(const uint32_t *w)
+{
+	uint32_t sum = 0;
+	for (unsigned i = 0; i < 7; i++)
+		sum += w[i];
+	return ~sum + 1;
+}
+
+static int lpc_flash_write_start(struct target_flash *tf,
+                                 target_addr dest, const void *src, size_t len)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+	target *t = tf->t;
+	int ret;
+	if (!lpc_iap_double_buffered(f) || f->reserved_pages ||
+	    (len != tf->buf_size)) {
+		while ((ret = lpc_flash_write_poll(tf)) > 0)
+			tf->stats.busy_polls++;
+		if (ret)
+			return ret;
+		return tf->write(tf, dest, src, len);
+	}
+	/* Upload while the previous block is programmed from the other buffer */
+	uint32_t bufaddr = lpc_iap_buf(f, f->iap_window);
+	target_mem_write(t, bufaddr, src, len);
+	if ((dest == 0) && (tf->write == lpc_flash_write_magic_vect)) {
+		/* Fill in the magic vector in the target buffer */
+		target_mem_write32(t, bufaddr + 7 * 4, lpc_magic_vect(src));
+	}
+	while ((ret = lpc_flash_write_poll(tf)) > 0)
+		tf->stats.busy_polls++;
+	if (ret)
+		return ret;
+	uint32_t sector = lpc_sector_for_addr(f, dest);
+	if (lpc_iap_call(f, NULL, IAP_CMD_PREPARE, sector, sector, f->bank)) {
+		DEBUG_WARN("Prepare failed\n");
+		return -1;
+	}
+	const uint32_t words[4] = {dest, bufaddr, len, CPU_CLK_KHZ};
+	lpc_iap_start(f, IAP_CMD_PROGRAM, words);
+	f->iap_window ^= 1;
+	return 0;
+}
+
+static int lpc_flash_write_poll(struct target_flash *tf)
+{
+	struct lpc_flash *f = (struct lpc_flash *)tf;
+	if (lpc_iap_busy(f))
+		return 1;
+	int ret = f->iap_job->status ? -2 : 0;
+	f->iap_job->status = IAP_STATUS_CMD_SUCCESS;
+	return ret;
+}
+
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len)
 {
 	if (dest == 0) {
 		/* Fill in the magic vector to allow booting the flash */
 		uint32_t *w = (uint32_t *)src;
-		uint32_t sum = 0;
-
-		/* compute checksum of first 7 vectors */
-		for (unsigned i = 0; i < 7; i++)
-			sum += w[i];
-		/* two's complement is written to 8'th vector */
-		w[7] = ~sum + 1;
+		w[7] = lpc_magic_vect(w);
 	}
 	return lpc_flash_write(f, dest, src, len);
 }
+
+void lpc_flash_fixup_magic_vect(struct target_flash *f, target_addr dest,
+                                void *buf, size_t len)
+{
+	(void)f;
+	if ((dest == 0) && (len >= 8 * 4))
+		((uint32_t *)buf)[7] = lpc_magic_vect(buf);
+}
@@ -68,6 +68,8 @@ enum iap_status {
 /* CPU Frequency */
 #define CPU_CLK_KHZ 12000
 
+struct lpc_iap_job;
+
 struct lpc_flash {
 	struct target_flash f;
 	uint8_t base_sector;
@@ -78,13 +80,19 @@ struct lpc_flash {
 	uint32_t iap_entry;
 	uint32_t iap_ram;
 	uint32_t iap_msp;
+	/* Asynchronous programming from two IAP buffers */
+	struct lpc_iap_job *iap_job;
+	uint8_t iap_window;
 };
 
-struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length);
+struct lpc_flash *lpc_add_flash(target *t, target_addr addr, size_t length,
+                                size_t blocksize, size_t max_copy);
 enum iap_status lpc_iap_call(struct lpc_flash *f, void *result, enum iap_cmd cmd, ...);
 int lpc_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 int lpc_flash_write_magic_vect(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+void lpc_flash_fixup_magic_vect(struct target_flash *f, target_addr dest,
+                                void *buf, size_t len);
 
 #endif
 
@@ -60,6 +60,9 @@ struct rp_priv_s {
 	uint16_t reset_usb_boot;
 	bool     is_prepared;
 	bool     is_monitor;
+	bool     is_programming; /* flash_range_program running */
+	uint8_t  write_window;   /* SRAM window for the next chunk */
+	platform_timeout program_timeout;
 	uint32_t regs[0x20];/* Register playground*/
 };
 
@@ -110,26 +113,48 @@ static bool rp2040_fill_table(struct rp_priv_s *priv, uint16_t *table, int max)
 	return (check != 9);
 }
 
-/* RP ROM functions calls
- *
- * timout == 0: Do not wait for poll, use for reset_usb_boot()
- * timeout > 500 (ms) : display spinner
+/* Start a RP ROM function call, the target halts at the end of the
+ * debug trampoline when it returns.
  */
-static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
-						uint32_t timeout)
+static void rp_rom_start(target *t, uint32_t *regs, uint32_t cmd)
 {
-	const char spinner[] = "|/-\\";
-	int spinindex = 0;
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
 	regs[7] = cmd;
 	regs[REG_LR] = ps->_debug_trampoline_end;
 	regs[REG_PC] = ps->_debug_trampoline;
 	regs[REG_MSP] = 0x20042000;
 	regs[REG_XPSR] = CORTEXM_XPSR_THUMB;
-	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
 	target_regs_write(t, regs);
 	/* start the target and wait for it to halt again */
 	target_halt_resume(t, false);
+}
+
+/* Check that a halted ROM call returned */
+static bool rp_rom_failed(target *t, uint32_t cmd)
+{
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	uint32_t dbg_regs[t->regs_size / sizeof(uint32_t)];
+	target_regs_read(t, dbg_regs);
+	bool ret = ((dbg_regs[REG_PC] &~1) != (ps->_debug_trampoline_end & ~1));
+	if (ret) {
+		DEBUG_WARN("rp_rom_call cmd %04" PRIx32 " failed, PC %08" PRIx32 "\n",
+				   cmd, dbg_regs[REG_PC]);
+	}
+	return ret;
+}
+
+/* RP ROM functions calls
+ *
+ * timout == 0: Do not wait for poll, use for reset_usb_boot()
+ * timeout > 500 (ms) : display spinner
+ */
+static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
+						uint32_t timeout)
+{
+	const char spinner[] = "|/-\\";
+	int spinindex = 0;
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	rp_rom_start(t, regs, cmd);
 	if (!timeout)
 		return false;
 	DEBUG_INFO("Call cmd %04" PRIx32 "\n", cmd);
@@ -153,13 +178,7 @@ static bool rp_rom_call(target *t, uint32_t *regs, uint32_t cmd,
 		}
 	} while (!target_halt_poll(t, NULL));
 	/* Debug */
-	target_regs_read(t, dbg_regs);
-	bool ret = ((dbg_regs[REG_PC] &~1) != (ps->_debug_trampoline_end & ~1));
-	if (ret) {
-		DEBUG_WARN("rp_rom_call cmd %04" PRIx32 " failed, PC %08" PRIx32 "\n",
-				   cmd, dbg_regs[REG_PC]);
-	}
-	return ret;
+	return rp_rom_failed(t, cmd);
 }
 
 static void rp_flash_prepare(target *t)
@@ -263,8 +282,36 @@ static int rp_flash_erase(struct target_flash *f, target_addr addr,
 	return ret;
 }
 
-int rp_flash_write(struct target_flash *f,
-                    target_addr dest, const void *src, size_t len)
+/* Flash programming is double buffered: while the ROM programs a chunk
+ * from one SRAM window, the next chunk is uploaded into the other one.
+ * The flash stays out of XIP mode until rp_flash_done().
+ */
+#define MAX_WRITE_CHUNK 0x1000
+
+static int rp_flash_write_poll(struct target_flash *f)
+{
+	target *t = f->t;
+	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
+	if (!ps->is_programming)
+		return 0;
+	if (!target_halt_poll(t, NULL)) {
+		if (!platform_timeout_is_expired(&ps->program_timeout))
+			return 1;
+		DEBUG_WARN("RP program timeout\n");
+		target_halt_request(t);
+		while (!target_halt_poll(t, NULL))
+			;
+	}
+	ps->is_programming = false;
+	if (rp_rom_failed(t, ps->flash_range_program)) {
+		DEBUG_WARN("Write failed!\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int rp_flash_write_start(struct target_flash *f,
+                                target_addr dest, const void *src, size_t len)
 {
 	DEBUG_INFO("RP Write %08" PRIx32 " len 0x%" PRIx32 "\n", dest, (uint32_t)len);
 	if ((dest & 0xff) || (len & 0xff)) {
@@ -272,36 +319,57 @@ int rp_flash_write(struct target_flash *f,
 		return -1;
 	}
 	target *t = f->t;
-	rp_flash_prepare(t);
 	struct rp_priv_s *ps = (struct rp_priv_s*)t->target_storage;
 	/* Write payload to target ram */
 	dest -= XIP_FLASH_START;
-	bool ret = 0;
-#define MAX_WRITE_CHUNK 0x1000
 	while (len) {
 		uint32_t chunksize = (len <= MAX_WRITE_CHUNK) ? len : MAX_WRITE_CHUNK;
-		target_mem_write(t, SRAM_START, src, chunksize);
+		uint32_t window = SRAM_START + ps->write_window * MAX_WRITE_CHUNK;
+		/* Upload while the ROM may still program the other window */
+		target_mem_write(t, window, src, chunksize);
+		int poll;
+		while ((poll = rp_flash_write_poll(f)) > 0)
+			f->stats.busy_polls++;
+		if (poll)
+			return -1;
+		rp_flash_prepare(t);
 		/* Programm range */
 		ps->regs[0] = dest;
-		ps->regs[1] = SRAM_START;
+		ps->regs[1] = window;
 		ps->regs[2] = chunksize;
+		rp_rom_start(t, ps->regs, ps->flash_range_program);
+		ps->is_programming = true;
 		/* Loading takes 3 ms per 256 byte page
 		 * however it takes much longer if the XOSC is not enabled
 		 * so lets give ourselves a little bit more time (x10)
 		 */
-		ret |= rp_rom_call(t, ps->regs, ps->flash_range_program,
-					(3 *  chunksize * 10) >> 8);
-		if (ret) {
-			DEBUG_WARN("Write failed!\n");
-			break;
-		}
+		platform_timeout_set(&ps->program_timeout, (3 * chunksize * 10) >> 8);
+		ps->write_window ^= 1;
 		len -= chunksize;
 		src += chunksize;
 		dest += chunksize;
 	}
+	return 0;
+}
+
+int rp_flash_write(struct target_flash *f,
+                    target_addr dest, const void *src, size_t len)
+{
+	int ret = rp_flash_write_start(f, dest, src, len);
+	int poll;
+	while ((poll = rp_flash_write_poll(f)) > 0)
+		f->stats.busy_polls++;
+	return (ret || poll) ? -1 : 0;
+}
+
+static int rp_flash_done(struct target_flash *f)
+{
+	target *t = f->t;
+	while (rp_flash_write_poll(f) > 0)
+		;
 	rp_flash_resume(t);
 	DEBUG_INFO("Write done!\n");
-	return ret;
+	return 0;
 }
 
 static bool rp_cmd_reset_usb_boot(target *t, int argc, const char *argv[])
@@ -351,7 +419,11 @@ static void rp_add_flash(target *t, uint32_t addr, size_t length)
         f->blocksize = 0x1000;
         f->erase = rp_flash_erase;
         f->write = rp_flash_write;
+        f->write_start = rp_flash_write_start;
+        f->write_poll = rp_flash_write_poll;
+        f->done = rp_flash_done;
         f->buf_size = 2048; /* Max buffer size used eotherwise */
+        f->writesize = MAX_WRITE_CHUNK;
         target_add_flash(t, f);
 }
 
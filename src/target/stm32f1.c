@@ -38,6 +38,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32f1_cmd_erase_mass(target *t, int argc, const char **argv);
 static bool stm32f1_cmd_option(target *t, int argc, const char **argv);
@@ -302,54 +303,62 @@ static int stm32f1_flash_erase(struct target_flash *f,
 	return 0;
 }
 
+/* Program through the RAM resident loader, or write flash directly
+ * over the debug link if the loader can not be used. */
+static int stm32f1_flash_program(struct target_flash *f, uint32_t bank_offset,
+                                 target_addr dest, const void *src, size_t len)
+{
+	target *t = f->t;
+	const struct flashloader_prog prog = {
+		.sr = FLASH_SR + bank_offset,
+		.busy = FLASH_SR_BSY,
+		.error = SR_ERROR_MASK,
+		.unit = 2,
+	};
+	uint32_t sr;
+
+	target_mem_write32(t, FLASH_CR + bank_offset, FLASH_CR_PG);
+	int ret = flashloader_write(f, &prog, dest, src, len);
+	if (ret <= 0)
+		return ret;
+	cortexm_mem_write_sized(t, dest, src, len, ALIGN_HALFWORD);
+	/* Read FLASH_SR to poll for BSY bit */
+	/* Wait for completion or an error */
+	do {
+		sr = target_mem_read32(t, FLASH_SR + bank_offset);
+		f->stats.busy_polls++;
+		if(target_check_error(t)) {
+			DEBUG_WARN("stm32f1 flash write: comm error\n");
+			return -1;
+		}
+	} while (sr & FLASH_SR_BSY);
+
+	if (sr & SR_ERROR_MASK) {
+		DEBUG_WARN("stm32f1 flash write error 0x%" PRIx32 "\n", sr);
+		return -1;
+	}
+	return 0;
+}
+
 static int stm32f1_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len)
 {
 	target *t = f->t;
-	uint32_t sr;
 	size_t length = 0;
 	if (dest < FLASH_BANK_SPLIT) {
 		if ((dest + len - 1) >= FLASH_BANK_SPLIT)
 			length = FLASH_BANK_SPLIT - dest;
 		else
 			length = len;
-		target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
-		/* Read FLASH_SR to poll for BSY bit */
-		/* Wait for completion or an error */
-		do {
-			sr = target_mem_read32(t, FLASH_SR);
-			if(target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash write: comm error\n");
-				return -1;
-			}
-		} while (sr & FLASH_SR_BSY);
-
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("stm32f1 flash write error 0x%" PRIx32 "\n", sr);
+		if (stm32f1_flash_program(f, 0, dest, src, length))
 			return -1;
-		}
 		dest += length;
 		src += length;
 	}
 	length = len - length;
 	if ((t->idcode == 0x430) && length) { /* Write on bank 2 */
-		target_mem_write32(t, FLASH_CR + FLASH_BANK2_OFFSET, FLASH_CR_PG);
-		cortexm_mem_write_sized(t, dest, src, length, ALIGN_HALFWORD);
-		/* Read FLASH_SR to poll for BSY bit */
-		/* Wait for completion or an error */
-		do {
-			sr = target_mem_read32(t, FLASH_SR + FLASH_BANK2_OFFSET);
-			if(target_check_error(t)) {
-				DEBUG_WARN("stm32f1 flash bank2 write: comm error\n");
-				return -1;
-			}
-		} while (sr & FLASH_SR_BSY);
-
-		if (sr & SR_ERROR_MASK) {
-			DEBUG_WARN("stm32f1 flash bank2 write error 0x%" PRIx32 "\n", sr);
+		if (stm32f1_flash_program(f, FLASH_BANK2_OFFSET, dest, src, length))
 			return -1;
-		}
 	}
 	return 0;
 }
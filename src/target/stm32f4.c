@@ -36,6 +36,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32f4_cmd_erase_mass(target *t, int argc, const char **argv);
 static bool stm32f4_cmd_option(target *t, int argc, char *argv[]);
@@ -55,6 +56,7 @@ static int stm32f4_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len);
 static int stm32f4_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32f4_flash_erase_bank(struct target_flash *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define FPEC_BASE	0x40023C00
@@ -153,6 +155,8 @@ static void stm32f4_add_flash(target *t,
 	f->erase = stm32f4_flash_erase;
 	f->write = stm32f4_flash_write;
 	f->buf_size = 1024;
+	/* Any length is programmed in one go, up to a whole sector */
+	f->writesize = blocksize;
 	f->erased = 0xff;
 	sf->base_sector = base_sector;
 	sf->bank_split = split;
@@ -361,6 +365,12 @@ static bool stm32f4_attach(target *t)
 			stm32f4_add_flash(t, bk2 + 0x20000, remains, 0x20000, 21, split);
 		}
 	}
+	/* A request for the whole flash, at either alias, is a mass erase */
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		f->erase_bank = stm32f4_flash_erase_bank;
+		f->bank_start = (f->start >= AXIM_BASE) ? AXIM_BASE : ITCM_BASE;
+		f->bank_length = max_flashsize << 10;
+	}
 	return true;
 }
 
@@ -431,13 +441,24 @@ static int stm32f4_flash_write(struct target_flash *f,
 	target *t = f->t;
 	uint32_t sr;
 	enum align psize = ((struct stm32f4_flash *)f)->psize;
+	const struct flashloader_prog prog = {
+		.sr = FLASH_SR,
+		.busy = FLASH_SR_BSY,
+		.error = SR_ERROR_MASK,
+		.unit = 1 << psize,
+	};
 	target_mem_write32(t, FLASH_CR,
 					   (psize * FLASH_CR_PSIZE16) | FLASH_CR_PG);
+	/* Program through the RAM resident loader if possible */
+	int ret = flashloader_write(f, &prog, dest, src, len);
+	if (ret <= 0)
+		return ret;
 	cortexm_mem_write_sized(t, dest, src, len, psize);
 	/* Read FLASH_SR to poll for BSY bit */
 	/* Wait for completion or an error */
 	do {
 		sr = target_mem_read32(t, FLASH_SR);
+		f->stats.busy_polls++;
 		if(target_check_error(t)) {
 			DEBUG_WARN("stm32f4 flash write: comm error\n");
 			return -1;
@@ -451,16 +472,13 @@ static int stm32f4_flash_write(struct target_flash *f,
 	return 0;
 }
 
-static bool stm32f4_cmd_erase_mass(target *t, int argc, const char **argv)
+static bool stm32f4_mass_erase(target *t, bool spin)
 {
-	(void)argc;
-	(void)argv;
 	const char spinner[] = "|/-\\";
 	int spinindex = 0;
 	struct target_flash *f = t->flash;
 	struct stm32f4_flash *sf = (struct stm32f4_flash *)f;
 
-	tc_printf(t, "Erasing flash... This may take a few seconds.  ");
 	stm32f4_flash_unlock(t);
 
 	/* Flash mass erase start instruction */
@@ -472,13 +490,11 @@ static bool stm32f4_cmd_erase_mass(target *t, int argc, const char **argv)
 
 	/* Read FLASH_SR to poll for BSY bit */
 	while (target_mem_read32(t, FLASH_SR) & FLASH_SR_BSY) {
-		tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
-		if(target_check_error(t)) {
-			tc_printf(t, "\n");
+		if (spin)
+			tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
+		if(target_check_error(t))
 			return false;
-		}
 	}
-	tc_printf(t, "\n");
 
 	/* Check for error */
 	uint32_t sr = target_mem_read32(t, FLASH_SR);
@@ -488,6 +504,23 @@ static bool stm32f4_cmd_erase_mass(target *t, int argc, const char **argv)
 	return true;
 }
 
+static bool stm32f4_cmd_erase_mass(target *t, int argc, const char **argv)
+{
+	(void)argc;
+	(void)argv;
+	tc_printf(t, "Erasing flash... This may take a few seconds.  ");
+	bool ret = stm32f4_mass_erase(t, true);
+	tc_printf(t, "\n");
+	return ret;
+}
+
+/* The whole flash is one bank for the generic code, erased without
+ * console output as GDB waits for the erase reply. */
+static int stm32f4_flash_erase_bank(struct target_flash *f)
+{
+	return stm32f4_mass_erase(f->t, false) ? 0 : -1;
+}
+
 /* Dev   | DOC  |Rev|ID |OPTCR    |OPTCR   |OPTCR1   |OPTCR1 | OPTCR2
                     |hex|default  |reserved|default  |resvd  | default|resvd
  * F20x  |pm0059|5.1|411|0FFFAAED |F0000010|
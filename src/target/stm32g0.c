@@ -45,6 +45,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 #include "command.h"
 
 /* FLASH */
@@ -402,7 +403,20 @@ static int stm32g0_flash_write(struct target_flash *f, target_addr dest,
 	stm32g0_flash_unlock(t);
 
 	target_mem_write32(t, FLASH_CR, FLASH_CR_PG);
-	target_mem_write(t, dest, src, len);
+	/* Program through the RAM resident loader if possible */
+	const struct flashloader_prog prog = {
+		.sr = FLASH_SR,
+		.busy = FLASH_SR_BSY_MASK,
+		.error = FLASH_SR_ERROR_MASK,
+		.unit = 8,
+	};
+	ret = flashloader_write(f, &prog, dest, src, len);
+	if (ret < 0)
+		goto exit_error;
+	if (ret) {
+		ret = 0;
+		target_mem_write(t, dest, src, len);
+	}
 	/* Wait for completion or an error */
 	uint32_t flash_sr;
 	do {
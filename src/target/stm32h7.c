@@ -36,12 +36,14 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "command.h"
 
 static bool stm32h7_cmd_erase_mass(target *t, int argc, const char **argv);
 /* static bool stm32h7_cmd_option(target *t, int argc, char *argv[]); */
 static bool stm32h7_uid(target *t, int argc, const char **argv);
 static bool stm32h7_crc(target *t, int argc, const char **argv);
 static bool stm32h7_cmd_psize(target *t, int argc, char *argv[]);
+static bool stm32h7_cmd_dual_bank(target *t, int argc, const char **argv);
 static bool stm32h7_cmd_rev(target *t, int argc, const char **argv);
 
 const struct command_s stm32h7_cmd_list[] = {
@@ -53,6 +55,8 @@ const struct command_s stm32h7_cmd_list[] = {
 	 "Configure flash write parallelism: (x8|x16|x32|x64(default))"},
 	{"uid", (cmd_handler)stm32h7_uid, "Print unique device ID"},
 	{"crc", (cmd_handler)stm32h7_crc, "Print CRC of both banks"},
+	{"dual_bank", (cmd_handler)stm32h7_cmd_dual_bank,
+	 "Program both banks in parallel: (enable(default)|disable)"},
 	{"revision", (cmd_handler)stm32h7_cmd_rev,
 	 "Returns the Device ID and Revision"},
 	{NULL, NULL, NULL}
@@ -63,6 +67,11 @@ static int stm32h7_flash_erase(struct target_flash *f, target_addr addr,
 							   size_t len);
 static int stm32h7_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32h7_flash_write_start(struct target_flash *f,
+                                     target_addr dest, const void *src,
+                                     size_t len);
+static int stm32h7_flash_write_poll(struct target_flash *f);
+static int stm32h7_flash_erase_bank(struct target_flash *f);
 
 static const char stm32h7_driver_str[] = "STM32H7";
 
@@ -186,7 +195,13 @@ static void stm32h7_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32h7_flash_erase;
 	f->write = stm32h7_flash_write;
+	/* Each bank has its own write queue */
+	f->write_start = stm32h7_flash_write_start;
+	f->write_poll = stm32h7_flash_write_poll;
+	f->erase_bank = stm32h7_flash_erase_bank;
 	f->buf_size = 2048;
+	/* Any length is programmed in one go, up to a whole sector */
+	f->writesize = blocksize;
 	f->erased = 0xff;
 	sf->regbase = FPEC1_BASE;
 	if (addr >= BANK2_START)
@@ -341,6 +356,7 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	uint32_t sr;
 	target_mem_write(t, dest, src, len);
 	while ((sr = target_mem_read32(t, sr_reg)) & FLASH_SR_BSY) {
+		f->stats.busy_polls++;
 		if(target_check_error(t)) {
 			DEBUG_WARN("stm32h7_flash_write: BSY comm failed\n");
 			return -1;
@@ -355,8 +371,59 @@ static int stm32h7_flash_write(struct target_flash *f, target_addr dest,
 	return 0;
 }
 
+/* Wait only for the previous write to this bank, while the other bank
+ * may still be programming. The data goes straight into the bank's write
+ * queue, there is no second buffer, so within one bank the transfer of
+ * the next block does not overlap programming; only the two banks do. */
+static int stm32h7_flash_write_start(struct target_flash *f,
+                                     target_addr dest, const void *src,
+                                     size_t len)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	int ret;
+	while ((ret = stm32h7_flash_write_poll(f)) > 0)
+		f->stats.busy_polls++;
+	if (ret)
+		return -1;
+	if (stm32h7_flash_unlock(t, dest) == false)
+		return -1;
+	uint32_t cr = sf->psize * FLASH_CR_PSIZE16;
+	target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+	cr |= FLASH_CR_PG;
+	target_mem_write32(t, sf->regbase + FLASH_CR, cr);
+	target_mem_write(t, dest, src, len);
+	if (target_check_error(t)) {
+		DEBUG_WARN("stm32h7_flash_write_start: comm failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int stm32h7_flash_write_poll(struct target_flash *f)
+{
+	target *t = f->t;
+	struct stm32h7_flash *sf = (struct stm32h7_flash *)f;
+	uint32_t sr = target_mem_read32(t, sf->regbase + FLASH_SR);
+	if (target_check_error(t)) {
+		DEBUG_WARN("stm32h7_flash_write_poll: comm failed\n");
+		return -1;
+	}
+	if (sr & (FLASH_SR_QW | FLASH_SR_BSY))
+		return 1;
+	/* Close write windows.*/
+	target_mem_write32(t, sf->regbase + FLASH_CR, 0);
+	if (sr & FLASH_SR_ERROR_MASK) {
+		DEBUG_WARN("stm32h7_flash_write: error sr %08" PRIx32 "\n", sr);
+		target_mem_write32(t, sf->regbase + FLASH_CCR,
+		                   sr & FLASH_SR_ERROR_MASK);
+		return -1;
+	}
+	return 0;
+}
+
 /* Both banks are erased in parallel.*/
-static bool stm32h7_cmd_erase(target *t, int bank_mask)
+static bool stm32h7_cmd_erase(target *t, int bank_mask, bool spin)
 {
 	const char spinner[] = "|/-\\";
 	int spinindex = 0;
@@ -397,7 +464,8 @@ static bool stm32h7_cmd_erase(target *t, int bank_mask)
 		uint32_t regbase = FPEC1_BASE;
 		while (target_mem_read32(t, regbase + FLASH_SR) & FLASH_SR_QW) {
 //			target_mem_write32(t, H7_IWDG_BASE, 0x0000aaaa);
-			tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
+			if (spin)
+				tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
 			if(target_check_error(t)) {
 				DEBUG_WARN("ME bank1: comm failed\n");
 				goto done;
@@ -408,7 +476,8 @@ static bool stm32h7_cmd_erase(target *t, int bank_mask)
 		uint32_t regbase = FPEC2_BASE;
 		while (target_mem_read32(t, regbase + FLASH_SR) & FLASH_SR_QW) {
 //			target_mem_write32(t, H7_IWDG_BASE 0x0000aaaa);
-			tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
+			if (spin)
+				tc_printf(t, "\b%c", spinner[spinindex++ % 4]);
 			if(target_check_error(t)) {
 				DEBUG_WARN("ME bank2: comm failed\n");
 				goto done;
@@ -436,16 +505,25 @@ static bool stm32h7_cmd_erase(target *t, int bank_mask)
 	}
 	result = true;
   done:
-	tc_printf(t, "\n");
+	if (spin)
+		tc_printf(t, "\n");
 	return result;
 }
 
+/* Erase the bank of a flash, without console output as GDB waits for
+ * the erase reply. */
+static int stm32h7_flash_erase_bank(struct target_flash *f)
+{
+	int bank_mask = (f->start >= BANK2_START) ? 2 : 1;
+	return stm32h7_cmd_erase(f->t, bank_mask, false) ? 0 : -1;
+}
+
 static bool stm32h7_cmd_erase_mass(target *t, int argc, const char **argv)
 {
 	(void)argc;
 	(void)argv;
 	tc_printf(t, "Erasing flash... This may take a few seconds.  ");
-	return stm32h7_cmd_erase(t, 3);
+	return stm32h7_cmd_erase(t, 3, true);
 }
 
 /* Print the Unique device ID.
@@ -473,7 +551,7 @@ static bool stm32h7_uid(target *t, int argc, const char **argv)
 	tc_printf(t, "\n");
 	return true;
 }
-static int stm32h7_crc_bank(target *t, uint32_t bank)
+static int stm32h7_crc_bank_start(target *t, uint32_t bank)
 {
 	uint32_t regbase = FPEC1_BASE;
 	if (bank >= BANK2_START)
@@ -487,6 +565,15 @@ static int stm32h7_crc_bank(target *t, uint32_t bank)
 		FLASH_CRCCR_CLEAN_CRC | FLASH_CRCCR_ALL_BANK;
 	target_mem_write32(t, regbase + FLASH_CRCCR, crccr);
 	target_mem_write32(t, regbase + FLASH_CRCCR, crccr | FLASH_CRCCR_START_CRC);
+	return 0;
+}
+
+static int stm32h7_crc_bank_wait(target *t, uint32_t bank, uint32_t *crc)
+{
+	uint32_t regbase = FPEC1_BASE;
+	if (bank >= BANK2_START)
+		regbase = FPEC2_BASE;
+
 	uint32_t sr;
 	while ((sr = target_mem_read32(t, regbase + FLASH_SR)) &
 		   FLASH_SR_CRC_BUSY) {
@@ -501,20 +588,51 @@ static int stm32h7_crc_bank(target *t, uint32_t bank)
 			return -1;
 		}
 	}
+	*crc = target_mem_read32(t, regbase + FLASH_CRCDATA);
+	target_mem_write32(t, regbase + FLASH_CR, 0);
 	return 0;
 }
 
+/* The CRC units of both banks run in parallel */
 static bool stm32h7_crc(target *t, int argc, const char **argv)
 {
 	(void)argc;
 	(void)argv;
-	if (stm32h7_crc_bank(t, BANK1_START) ) return false;
-	uint32_t crc1 = target_mem_read32(t, FPEC1_BASE + FLASH_CRCDATA);
-	if (stm32h7_crc_bank(t, BANK2_START) ) return false;
-	uint32_t crc2 = target_mem_read32(t, FPEC1_BASE + FLASH_CRCDATA);
-	tc_printf(t, "CRC: bank1 0x%08lx, bank2 0x%08lx\n", crc1, crc2);
+	uint32_t crc1, crc2;
+	if (stm32h7_crc_bank_start(t, BANK1_START) ||
+		stm32h7_crc_bank_start(t, BANK2_START))
+		return false;
+	if (stm32h7_crc_bank_wait(t, BANK1_START, &crc1) ||
+		stm32h7_crc_bank_wait(t, BANK2_START, &crc2))
+		return false;
+	tc_printf(t, "CRC: bank1 0x%08" PRIx32 ", bank2 0x%08" PRIx32 "\n",
+			  crc1, crc2);
+	return true;
+}
+
+static bool stm32h7_cmd_dual_bank(target *t, int argc, const char **argv)
+{
+	if (argc == 1) {
+		bool enabled = false;
+		for (struct target_flash *f = t->flash; f; f = f->next)
+			if (f->write == stm32h7_flash_write)
+				enabled = f->write_start != NULL;
+		tc_printf(t, "Dual bank programming %s\n",
+				  enabled ? "enabled" : "disabled");
+		return true;
+	}
+	bool enable;
+	if (!parse_enable_or_disable(argv[1], &enable))
+		return false;
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		if (f->write == stm32h7_flash_write) {
+			f->write_start = enable ? stm32h7_flash_write_start : NULL;
+			f->write_poll = enable ? stm32h7_flash_write_poll : NULL;
+		}
+	}
 	return true;
 }
+
 static bool stm32h7_cmd_psize(target *t, int argc, char *argv[])
 {
 	(void)argc;
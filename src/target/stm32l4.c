@@ -37,6 +37,7 @@
 #include "target.h"
 #include "target_internal.h"
 #include "cortexm.h"
+#include "flashloader.h"
 
 static bool stm32l4_cmd_erase_mass(target *t, int argc, const char **argv);
 static bool stm32l4_cmd_erase_bank1(target *t, int argc, const char **argv);
@@ -54,6 +55,7 @@ const struct command_s stm32l4_cmd_list[] = {
 static int stm32l4_flash_erase(struct target_flash *f, target_addr addr, size_t len);
 static int stm32l4_flash_write(struct target_flash *f,
                                target_addr dest, const void *src, size_t len);
+static int stm32l4_flash_erase_bank(struct target_flash *f);
 
 /* Flash Program ad Erase Controller Register Map */
 #define L4_FPEC_BASE			0x40022000
@@ -357,6 +359,7 @@ static void stm32l4_add_flash(target *t,
 	f->blocksize = blocksize;
 	f->erase = stm32l4_flash_erase;
 	f->write = stm32l4_flash_write;
+	f->erase_bank = stm32l4_flash_erase_bank;
 	f->buf_size = 2048;
 	f->erased = 0xff;
 	sf->bank1_start = bank1_start;
@@ -571,11 +574,22 @@ static int stm32l4_flash_write(struct target_flash *f,
 {
 	target *t = f->t;
 	stm32l4_flash_write32(t, FLASH_CR, FLASH_CR_PG);
+	/* Program through the RAM resident loader if possible */
+	const struct flashloader_prog prog = {
+		.sr = stm32l4_get_chip_info(t->idcode)->flash_regs_map[FLASH_SR],
+		.busy = FLASH_SR_BSY,
+		.error = FLASH_SR_ERROR_MASK,
+		.unit = 8,
+	};
+	int ret = flashloader_write(f, &prog, dest, src, len);
+	if (ret <= 0)
+		return ret;
 	target_mem_write(t, dest, src, len);
 	/* Wait for completion or an error */
 	uint32_t sr;
 	do {
 		sr = stm32l4_flash_read32(t, FLASH_SR);
+		f->stats.busy_polls++;
 		if (target_check_error(t)) {
 			DEBUG_WARN("stm32l4 flash write: comm error\n");
 			return -1;
@@ -611,6 +625,17 @@ static bool stm32l4_cmd_erase(target *t, uint32_t action)
 	return true;
 }
 
+static int stm32l4_flash_erase_bank(struct target_flash *f)
+{
+	struct stm32l4_flash *sf = (struct stm32l4_flash *)f;
+	uint32_t action = FLASH_CR_MER1 | FLASH_CR_MER2;
+	if (sf->bank1_start != (uint32_t)-1)
+		action = (f->start < sf->bank1_start) ? FLASH_CR_MER1 : FLASH_CR_MER2;
+	/* Clear stale errors as the page erase does */
+	stm32l4_flash_write32(f->t, FLASH_SR, stm32l4_flash_read32(f->t, FLASH_SR));
+	return stm32l4_cmd_erase(f->t, action) ? 0 : -1;
+}
+
 static bool stm32l4_cmd_erase_mass(target *t, int argc, const char **argv)
 {
 	(void)argc;
@@ -20,6 +20,7 @@
 
 #include "general.h"
 #include "target_internal.h"
+#include "crc32.h"
 
 #include <stdarg.h>
 
@@ -29,6 +30,48 @@ static int target_flash_write_buffered(struct target_flash *f,
                                        target_addr dest, const void *src, size_t len);
 static int target_flash_done_buffered(struct target_flash *f);
 
+/* Sector buffers are lent from one arena to one flash at a time instead of
+ * being allocated for every flash session. Platforms may size the arena,
+ * flashes with larger buffers, or finding the arena taken, use the heap. */
+#if !defined(FLASH_BUF_ARENA_SIZE)
+# if PC_HOSTED == 1
+#  define FLASH_BUF_ARENA_SIZE	0x20000
+# else
+#  define FLASH_BUF_ARENA_SIZE	0x1000
+# endif
+#endif
+#if PC_HOSTED == 1
+/* Allocated once per GDB session thread */
+static SESSION_LOCAL uint8_t *flash_buf_arena;
+#else
+static uint8_t flash_buf_arena[FLASH_BUF_ARENA_SIZE] __attribute__((aligned(8)));
+#endif
+static SESSION_LOCAL struct target_flash *flash_buf_owner;
+
+/* Direct mapped read cache over the RAM and flash regions of a target.
+ * Lines are only filled while the target is known to be halted and are
+ * dropped on resume, reset, memory writes, flash operations and driver
+ * commands. Anything outside t->ram and t->flash (MMIO) is never cached.
+ */
+#define MEM_CACHE_LINE_SIZE	64
+#if PC_HOSTED == 1
+# define MEM_CACHE_LINES	64
+#else
+# define MEM_CACHE_LINES	8
+#endif
+#define MEM_CACHE_INVALID	((target_addr)-1)
+
+struct target_mem_cache {
+	bool halted;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t bypassed;
+	struct {
+		target_addr addr;
+		uint8_t data[MEM_CACHE_LINE_SIZE];
+	} line[MEM_CACHE_LINES];
+};
+
 static bool nop_function(void)
 {
 	return true;
@@ -93,8 +136,12 @@ void target_mem_map_free(target *t)
 	}
 	while (t->flash) {
 		void * next = t->flash->next;
-		if (t->flash->buf)
+		if (t->flash->buf && !t->flash->buf_in_arena)
 			free(t->flash->buf);
+		if (t->flash == flash_buf_owner)
+			flash_buf_owner = NULL;
+		free(t->flash->erase_pending);
+		free(t->flash->inc_buf);
 		free(t->flash);
 		t->flash = next;
 	}
@@ -116,6 +163,7 @@ void target_list_free(void)
 			target_list->commands = tc;
 		}
 		free(target_list->target_storage);
+		free(target_list->mem_cache);
 		target_mem_map_free(target_list);
 		while (target_list->bw_list) {
 			void * next = target_list->bw_list->next;
@@ -151,9 +199,16 @@ target *target_attach_n(int n, struct target_controller *tc)
 {
 	target *t;
 	int i;
-	for(t = target_list, i = 1; t; t = t->next, i++)
-		if(i == n)
-			return target_attach(t, tc);
+	for(t = target_list, i = 1; t; t = t->next, i++) {
+		if(i != n)
+			continue;
+		/* Don't take a target away from another GDB session */
+		if (t->attached && t->tc && (t->tc != tc)) {
+			DEBUG_WARN("Target %d in use by another session\n", n);
+			return NULL;
+		}
+		return target_attach(t, tc);
+	}
 	return NULL;
 }
 
@@ -168,6 +223,10 @@ target *target_attach(target *t, struct target_controller *tc)
 		return NULL;
 
 	t->attached = true;
+	if (t->mem_cache) {
+		target_mem_cache_invalidate(t);
+		t->mem_cache->halted = true;
+	}
 	return t;
 }
 
@@ -189,6 +248,15 @@ void target_add_flash(target *t, struct target_flash *f)
 {
 	if (f->buf_size == 0)
 		f->buf_size = MIN(f->blocksize, 0x400);
+	/* Program in the largest chunks the driver, flash and arena allow */
+	while ((f->buf_size * 2 <= f->writesize) &&
+	       (f->buf_size * 2 <= f->blocksize) &&
+	       (f->buf_size * 2 <= FLASH_BUF_ARENA_SIZE))
+		f->buf_size *= 2;
+	if (f->erase_bank && !f->bank_length) {
+		f->bank_start = f->start;
+		f->bank_length = f->length;
+	}
 	f->t = t;
 	f->next = t->flash;
 	t->flash = f;
@@ -239,9 +307,328 @@ static struct target_flash *flash_for_addr(target *t, uint32_t addr)
 	return NULL;
 }
 
+/* Wait for an asynchronous write to complete */
+static int flash_write_wait(struct target_flash *f)
+{
+	int ret;
+	if (!f->write_pending)
+		return 0;
+	uint32_t start_time = platform_time_ms();
+	while ((ret = f->write_poll(f)) > 0)
+		f->stats.busy_polls++;
+	f->stats.program_ms += platform_time_ms() - start_time;
+	f->write_pending = false;
+	return ret ? 1 : 0;
+}
+
+#if PC_HOSTED == 1
+/* Let the compiler use SIMD registers for the compare */
+typedef uint32_t flash_word __attribute__((vector_size(16)));
+#else
+typedef uint32_t flash_word;
+#endif
+
+/* Check if a buffer only holds the erased value, one word at a time */
+static bool flash_buf_erased(const void *buf, size_t len, uint8_t erased)
+{
+	const uint8_t *data = buf;
+	flash_word pattern, diff, word;
+	memset(&pattern, erased, sizeof(pattern));
+	memset(&diff, 0, sizeof(diff));
+	size_t i = 0;
+	for (; i + sizeof(word) <= len; i += sizeof(word)) {
+		memcpy(&word, data + i, sizeof(word));
+		diff |= word ^ pattern;
+	}
+	for (; i < len; i++)
+		if (data[i] != erased)
+			return false;
+	for (i = 0; i < sizeof(diff) / sizeof(uint32_t); i++)
+		if (((uint32_t *)&diff)[i])
+			return false;
+	return true;
+}
+
+/* Program a whole buffer, asynchronously if the driver supports it.
+ * Buffers holding only the erased value need no programming. */
+static int flash_write_from(struct target_flash *f, target_addr dest,
+                            const void *src, size_t len)
+{
+	if (flash_buf_erased(src, len, f->erased)) {
+		f->stats.bytes_skipped += len;
+		f->stats.bufs_skipped++;
+		return 0;
+	}
+	f->stats.bytes_programmed += len;
+	int ret;
+	uint32_t start_time = platform_time_ms();
+	if (!f->write_start) {
+		ret = f->write(f, dest, src, len);
+	} else {
+		f->write_pending = true;
+		ret = f->write_start(f, dest, src, len);
+	}
+	f->stats.program_ms += platform_time_ms() - start_time;
+	if (ret)
+		flash_write_wait(f);
+	return ret;
+}
+
+/* Program the sector buffer */
+static int flash_write_buf(struct target_flash *f)
+{
+	f->stats.buf_flushes++;
+	return flash_write_from(f, f->buf_addr, f->buf, f->buf_size);
+}
+
+/* Incremental flashing defers the erases GDB requests and collects the data
+ * for each erase block. A block is only erased and programmed if the CRC of
+ * its new content differs from the CRC of the flash, which generic_crc32()
+ * computes on the target where possible.
+ */
+bool target_flash_incremental = false;
+#if PC_HOSTED == 1
+# define FLASH_INC_MAX_BLOCK	0x40000
+#else
+/* The block buffer comes from the small firmware heap */
+# define FLASH_INC_MAX_BLOCK	0x800
+#endif
+#define FLASH_INC_NONE		((target_addr)-1)
+
+static bool flash_inc_pending(struct target_flash *f, target_addr addr)
+{
+	uint32_t block = (addr - f->start) / f->blocksize;
+	return f->erase_pending[block / 8] & (1 << (block % 8));
+}
+
+static void flash_inc_clear(struct target_flash *f, target_addr addr)
+{
+	uint32_t block = (addr - f->start) / f->blocksize;
+	f->erase_pending[block / 8] &= ~(1 << (block % 8));
+}
+
+/* Record an erase request instead of erasing, returns false if incremental
+ * flashing is not possible for this flash. */
+static bool flash_inc_erase(struct target_flash *f, target_addr addr,
+                            size_t len)
+{
+	if (!target_flash_incremental || (f->blocksize > FLASH_INC_MAX_BLOCK) ||
+	    (f->length % f->blocksize))
+		return false;
+	if (!f->erase_pending) {
+		size_t blocks = f->length / f->blocksize;
+		f->erase_pending = calloc((blocks + 7) / 8, 1);
+		f->inc_buf = malloc(f->blocksize);
+		if (!f->erase_pending || !f->inc_buf) {	/* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			free(f->erase_pending);
+			free(f->inc_buf);
+			f->erase_pending = NULL;
+			f->inc_buf = NULL;
+			return false;
+		}
+		f->inc_addr = FLASH_INC_NONE;
+	}
+	target_addr end = addr + len;
+	for (addr -= (addr - f->start) % f->blocksize; addr < end;
+	     addr += f->blocksize) {
+		uint32_t block = (addr - f->start) / f->blocksize;
+		f->erase_pending[block / 8] |= 1 << (block % 8);
+	}
+	return true;
+}
+
+/* Bring the erase block at addr to the content of buf, if it differs */
+static int flash_inc_update(struct target_flash *f, target_addr addr,
+                            const uint8_t *buf, bool program)
+{
+	target *t = f->t;
+	uint32_t crc;
+	flash_inc_clear(f, addr);
+	f->stats.inc_blocks++;
+	if (program && f->fixup)
+		f->fixup(f, addr, f->inc_buf, f->blocksize);
+	/* The CRC stub must not run while an asynchronous write is active */
+	int ret = 0;
+	for (struct target_flash *b = t->flash; b; b = b->next)
+		ret |= flash_write_wait(b);
+	uint32_t start_time = platform_time_ms();
+	bool unchanged = !generic_crc32(t, &crc, addr, f->blocksize) &&
+		(crc == crc32_buffer(buf, f->blocksize));
+	f->stats.crc_ms += platform_time_ms() - start_time;
+	if (unchanged) {
+		f->stats.inc_skipped++;
+		return ret;
+	}
+	ret |= f->erase(f, addr, f->blocksize);
+	if (program)
+		ret |= target_flash_write_buffered(f, addr, buf, f->blocksize);
+	return ret;
+}
+
+static int flash_inc_write(struct target_flash *f,
+                           target_addr dest, const void *src, size_t len)
+{
+	int ret = 0;
+	while (len) {
+		uint32_t offset = (dest - f->start) % f->blocksize;
+		target_addr base = dest - offset;
+		size_t blocklen = MIN(f->blocksize - offset, len);
+		if (base != f->inc_addr) {
+			if (f->inc_addr != FLASH_INC_NONE)
+				ret |= flash_inc_update(f, f->inc_addr, f->inc_buf, true);
+			f->inc_addr = FLASH_INC_NONE;
+			if (!flash_inc_pending(f, base)) {
+				/* Not erased by GDB, so program as requested */
+				ret |= target_flash_write_buffered(f, dest, src, blocklen);
+				goto next;
+			}
+			f->inc_addr = base;
+			memset(f->inc_buf, f->erased, f->blocksize);
+		}
+		memcpy(f->inc_buf + offset, src, blocklen);
+next:
+		dest += blocklen;
+		src += blocklen;
+		len -= blocklen;
+	}
+	return ret;
+}
+
+/* Finish the last written block and erase the remaining requested blocks
+ * unless they already are erased. */
+static int flash_inc_done(struct target_flash *f)
+{
+	int ret = 0;
+	if (!f->erase_pending)
+		return 0;
+	if (f->inc_addr != FLASH_INC_NONE)
+		ret |= flash_inc_update(f, f->inc_addr, f->inc_buf, true);
+	memset(f->inc_buf, f->erased, f->blocksize);
+	for (target_addr addr = f->start; addr < f->start + f->length;
+	     addr += f->blocksize)
+		if (flash_inc_pending(f, addr))
+			ret |= flash_inc_update(f, addr, f->inc_buf, false);
+	free(f->erase_pending);
+	free(f->inc_buf);
+	f->erase_pending = NULL;
+	f->inc_buf = NULL;
+	return ret;
+}
+
+/* Sum up the statistics of all flash regions */
+const struct target_flash_stats *target_flash_stats(target *t)
+{
+	uint32_t *sum = (uint32_t *)&t->flash_stats;
+	memset(&t->flash_stats, 0, sizeof(t->flash_stats));
+	for (struct target_flash *f = t->flash; f; f = f->next) {
+		const uint32_t *stat = (const uint32_t *)&f->stats;
+		for (size_t i = 0; i < sizeof(f->stats) / sizeof(uint32_t); i++)
+			sum[i] += stat[i];
+	}
+	return &t->flash_stats;
+}
+
+int target_flash_stats_foreach(target *t,
+	void (*cb)(target_addr start, size_t length,
+	           const struct target_flash_stats *stats, void *context),
+	void *context)
+{
+	int i = 0;
+	for (struct target_flash *f = t->flash; f; f = f->next, i++)
+		cb(f->start, f->length, &f->stats, context);
+	return i;
+}
+
+/* Statistics cover everything from the first flash operation on */
+static void flash_session_start(target *t)
+{
+	if (t->flash_active)
+		return;
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		memset(&f->stats, 0, sizeof(f->stats));
+	t->flash_active = true;
+}
+
+/* Write out a pending sector buffer and give the buffer back */
+static int flash_buf_put(struct target_flash *f)
+{
+	int ret = 0;
+	if ((f->buf != NULL) && (f->buf_addr != (uint32_t)-1)) {
+		/* Write sector to flash if valid */
+		ret = flash_write_buf(f);
+	}
+	ret |= flash_write_wait(f);
+	if (f->buf_in_arena)
+		flash_buf_owner = NULL;
+	else
+		free(f->buf);
+	f->buf = NULL;
+	f->buf_in_arena = false;
+	f->buf_addr = -1;
+	return ret;
+}
+
+/* Provide a sector buffer, from the arena if it is large enough and free.
+ * A buffer held by another flash is never written out early: its sector
+ * may still be filled later, which would program it twice. */
+static int flash_buf_get(struct target_flash *f)
+{
+	if ((f->buf_size > FLASH_BUF_ARENA_SIZE) || flash_buf_owner) {
+		f->buf = malloc(f->buf_size);
+		if (!f->buf) {			/* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return 1;
+		}
+		f->buf_addr = -1;
+		return 0;
+	}
+#if PC_HOSTED == 1
+	if (!flash_buf_arena) {
+		flash_buf_arena = malloc(FLASH_BUF_ARENA_SIZE);
+		if (!flash_buf_arena) {	/* malloc failed: heap exhaustion */
+			DEBUG_WARN("malloc: failed in %s\n", __func__);
+			return 1;
+		}
+	}
+#endif
+	f->buf = flash_buf_arena;
+	f->buf_in_arena = true;
+	f->buf_addr = -1;
+	flash_buf_owner = f;
+	return 0;
+}
+
+/* Erase a whole bank in one go instead of block by block */
+static int flash_erase_bank(struct target_flash *f)
+{
+	target *t = f->t;
+	int ret = 0;
+	target_addr bank_end = f->bank_start + f->bank_length;
+	for (struct target_flash *b = t->flash; b; b = b->next)
+		if ((b->start >= f->bank_start) && (b->start < bank_end))
+			ret |= flash_write_wait(b);
+	uint32_t start_time = platform_time_ms();
+	ret |= f->erase_bank(f);
+	uint32_t ms = platform_time_ms() - start_time;
+	struct target_flash_stats *stats = &f->stats;
+	uint32_t blocks = 0;
+	for (struct target_flash *b = t->flash; b; b = b->next)
+		if ((b->start >= f->bank_start) && (b->start < bank_end))
+			blocks += b->length / b->blocksize;
+	stats->bank_erases++;
+	stats->bank_erase_blocks += blocks;
+	stats->bank_erase_ms += ms;
+	DEBUG_INFO("Bank erase at 0x%08" PRIx32 " for %" PRIu32
+	           " blocks took %" PRIu32 " ms\n", f->bank_start, blocks, ms);
+	return ret;
+}
+
 int target_flash_erase(target *t, target_addr addr, size_t len)
 {
 	int ret = 0;
+	target_mem_cache_invalidate(t);
+	flash_session_start(t);
 	while (len) {
 		struct target_flash *f = flash_for_addr(t, addr);
 		if (!f) {
@@ -250,24 +637,111 @@ int target_flash_erase(target *t, target_addr addr, size_t len)
 		}
 		size_t tmptarget = MIN(addr + len, f->start + f->length);
 		size_t tmplen = tmptarget - addr;
-		ret |= f->erase(f, addr, tmplen);
+		/* Incremental flashing defers erases until the data is known */
+		bool deferred = flash_inc_erase(f, addr, tmplen);
+		if (!deferred && f->erase_bank && (addr == f->bank_start) &&
+		    (len >= f->bank_length)) {
+			ret |= flash_erase_bank(f);
+			addr += f->bank_length;
+			len -= f->bank_length;
+			continue;
+		}
+		if (!deferred) {
+			ret |= flash_write_wait(f);
+			uint32_t start_time = platform_time_ms();
+			ret |= f->erase(f, addr, tmplen);
+			f->stats.erase_ms += platform_time_ms() - start_time;
+			f->stats.erase_blocks +=
+				(tmplen + f->blocksize - 1) / f->blocksize;
+		}
 		addr += tmplen;
 		len -= tmplen;
 	}
 	return ret;
 }
 
+/* Flashes in different banks with asynchronous writes program at the
+ * same time, so one bank can program while the data for the other is
+ * transferred. */
+static bool flash_can_interleave(struct target_flash *a,
+                                 struct target_flash *b)
+{
+	return b && a->write_start && b->write_start &&
+		!a->erase_pending && !b->erase_pending &&
+		(a->bank_start != b->bank_start);
+}
+
+/* Write from dest to the end of flash a and on into flash b, feeding
+ * whole buffers to both flashes in turns. Partial buffers at the ends
+ * go through the sector buffers as usual. Only a single write spanning
+ * both flashes gets here, such as a whole image from the hosted tool;
+ * GDB's load sends small packets in address order and never does. */
+static int flash_write_interleaved(struct target_flash *a,
+                                   struct target_flash *b, target_addr dest,
+                                   const uint8_t *src, size_t len)
+{
+	int ret = 0;
+	size_t alen = a->start + a->length - dest;
+	size_t blen = MIN(len - alen, b->length);
+	const uint8_t *bsrc = src + alen;
+	target_addr bdest = b->start;
+	size_t head = MIN((a->buf_size - dest % a->buf_size) % a->buf_size,
+	                  alen);
+	if (head) {
+		ret |= target_flash_write_buffered(a, dest, src, head);
+		dest += head;
+		src += head;
+		alen -= head;
+	}
+	/* Buffered data must not overlap the directly written buffers */
+	ret |= target_flash_done_buffered(a);
+	ret |= target_flash_done_buffered(b);
+	while (!ret && ((alen >= a->buf_size) || (blen >= b->buf_size))) {
+		if (alen >= a->buf_size) {
+			ret |= flash_write_from(a, dest, src, a->buf_size);
+			dest += a->buf_size;
+			src += a->buf_size;
+			alen -= a->buf_size;
+		}
+		if (blen >= b->buf_size) {
+			ret |= flash_write_from(b, bdest, bsrc, b->buf_size);
+			bdest += b->buf_size;
+			bsrc += b->buf_size;
+			blen -= b->buf_size;
+		}
+	}
+	if (alen)
+		ret |= target_flash_write_buffered(a, dest, src, alen);
+	if (blen)
+		ret |= target_flash_write_buffered(b, bdest, bsrc, blen);
+	return ret;
+}
+
 int target_flash_write(target *t,
                        target_addr dest, const void *src, size_t len)
 {
 	int ret = 0;
+	target_mem_cache_invalidate(t);
+	flash_session_start(t);
 	while (len) {
 		struct target_flash *f = flash_for_addr(t, dest);
 		if (!f)
 			return 1;
 		size_t tmptarget = MIN(dest + len, f->start + f->length);
 		size_t tmplen = tmptarget - dest;
-		ret |= target_flash_write_buffered(f, dest, src, tmplen);
+		f->stats.bytes_requested += tmplen;
+		struct target_flash *next = NULL;
+		if (tmplen < len)
+			next = flash_for_addr(t, f->start + f->length);
+		if (flash_can_interleave(f, next)) {
+			size_t nextlen = MIN(len - tmplen, next->length);
+			next->stats.bytes_requested += nextlen;
+			ret |= flash_write_interleaved(f, next, dest, src, len);
+			tmplen += nextlen;
+		} else if (f->erase_pending)
+			ret |= flash_inc_write(f, dest, src, tmplen);
+		else
+			ret |= target_flash_write_buffered(f, dest, src, tmplen);
 		dest += tmplen;
 		src += tmplen;
 		len -= tmplen;
@@ -277,17 +751,46 @@ int target_flash_write(target *t,
 
 int target_flash_done(target *t)
 {
+	int ret = 0;
+	target_mem_cache_invalidate(t);
 	for (struct target_flash *f = t->flash; f; f = f->next) {
-		int tmp = target_flash_done_buffered(f);
-		if (tmp)
-			return tmp;
+		ret = flash_inc_done(f);
+		ret |= target_flash_done_buffered(f);
+		if (ret)
+			break;
 		if (f->done) {
-			tmp = f->done(f);
-			if (tmp)
-				return tmp;
+			ret = f->done(f);
+			if (ret)
+				break;
 		}
 	}
-	return 0;
+	if (t->flash_active) {
+		const struct target_flash_stats *stats = target_flash_stats(t);
+		DEBUG_INFO("Flash: %" PRIu32 " bytes requested, %" PRIu32
+		           " programmed, %" PRIu32 " erased buffers skipped\n",
+		           stats->bytes_requested, stats->bytes_programmed,
+		           stats->bufs_skipped);
+		DEBUG_INFO("Flash: erase %" PRIu32 " ms, program %" PRIu32
+		           " ms, %" PRIu32 " busy polls\n",
+		           stats->erase_ms + stats->bank_erase_ms,
+		           stats->program_ms, stats->busy_polls);
+		if (stats->inc_blocks)
+			DEBUG_INFO("Incremental flash: %" PRIu32 " of %" PRIu32
+			           " blocks unchanged\n", stats->inc_skipped,
+			           stats->inc_blocks);
+		if (stats->bank_erases && stats->erase_blocks) {
+			/* Estimate from the blocks erased one by one */
+			int32_t saved = (int32_t)((uint64_t)stats->bank_erase_blocks *
+			                          stats->erase_ms / stats->erase_blocks) -
+			                (int32_t)stats->bank_erase_ms;
+			DEBUG_INFO("Bank erases saved about %" PRId32 " ms\n", saved);
+		} else if (stats->bank_erases) {
+			DEBUG_INFO("Bank erases replaced %" PRIu32 " block erases\n",
+			           stats->bank_erase_blocks);
+		}
+		t->flash_active = false;
+	}
+	return ret;
 }
 
 int target_flash_write_buffered(struct target_flash *f,
@@ -295,23 +798,15 @@ int target_flash_write_buffered(struct target_flash *f,
 {
 	int ret = 0;
 
-	if (f->buf == NULL) {
-		/* Allocate flash sector buffer */
-		f->buf = malloc(f->buf_size);
-		if (!f->buf) {			/* malloc failed: heap exhaustion */
-			DEBUG_WARN("malloc: failed in %s\n", __func__);
-			return 1;
-		}
-		f->buf_addr = -1;
-	}
+	if ((f->buf == NULL) && flash_buf_get(f))
+		return 1;
 	while (len) {
 		uint32_t offset = dest % f->buf_size;
 		uint32_t base = dest - offset;
 		if (base != f->buf_addr) {
 			if (f->buf_addr != (uint32_t)-1) {
 				/* Write sector to flash if valid */
-				ret |= f->write(f, f->buf_addr,
-				                f->buf, f->buf_size);
+				ret |= flash_write_buf(f);
 			}
 			/* Setup buffer for a new sector */
 			f->buf_addr = base;
@@ -329,16 +824,7 @@ int target_flash_write_buffered(struct target_flash *f,
 
 int target_flash_done_buffered(struct target_flash *f)
 {
-	int ret = 0;
-	if ((f->buf != NULL) &&(f->buf_addr != (uint32_t)-1)) {
-		/* Write sector to flash if valid */
-		ret = f->write(f, f->buf_addr, f->buf, f->buf_size);
-		f->buf_addr = -1;
-		free(f->buf);
-		f->buf = NULL;
-	}
-
-	return ret;
+	return flash_buf_put(f);
 }
 
 /* Wrapper functions */
@@ -346,6 +832,10 @@ void target_detach(target *t)
 {
 	t->detach(t);
 	t->attached = false;
+	if (t->mem_cache) {
+		target_mem_cache_invalidate(t);
+		t->mem_cache->halted = false;
+	}
 #if PC_HOSTED == 1
 	platform_buffer_flush();
 #endif
@@ -360,15 +850,117 @@ bool target_check_error(target *t) {
 
 bool target_attached(target *t) { return t->attached; }
 
+/* Forget the controller without touching the target, e.g. after the
+ * probe faulted and the target may not respond. */
+void target_release(target *t)
+{
+	t->attached = false;
+	t->tc = NULL;
+}
+
+/* Memory read cache */
+bool target_mem_cache_enable(target *t, bool enable)
+{
+	if (!enable) {
+		free(t->mem_cache);
+		t->mem_cache = NULL;
+		return true;
+	}
+	if (t->mem_cache)
+		return true;
+	t->mem_cache = calloc(1, sizeof(*t->mem_cache));
+	if (!t->mem_cache) {		/* calloc failed: heap exhaustion */
+		DEBUG_WARN("calloc: failed in %s\n", __func__);
+		return false;
+	}
+	target_mem_cache_invalidate(t);
+	/* Monitor commands are only accepted while the target is halted */
+	t->mem_cache->halted = true;
+	return true;
+}
+
+bool target_mem_cache_stats(target *t, uint32_t *hits, uint32_t *misses,
+                            uint32_t *bypassed)
+{
+	if (!t->mem_cache)
+		return false;
+	*hits = t->mem_cache->hits;
+	*misses = t->mem_cache->misses;
+	*bypassed = t->mem_cache->bypassed;
+	return true;
+}
+
+void target_mem_cache_invalidate(target *t)
+{
+	if (!t || !t->mem_cache)
+		return;
+	for (int i = 0; i < MEM_CACHE_LINES; i++)
+		t->mem_cache->line[i].addr = MEM_CACHE_INVALID;
+}
+
+static bool mem_cache_cacheable(target *t, target_addr addr)
+{
+	target_addr end = addr + MEM_CACHE_LINE_SIZE;
+	for (struct target_ram *r = t->ram; r; r = r->next)
+		if ((r->start <= addr) && (end <= r->start + r->length))
+			return true;
+	for (struct target_flash *f = t->flash; f; f = f->next)
+		if ((f->start <= addr) && (end <= f->start + f->length))
+			return true;
+	return false;
+}
+
+/* Serve a read from the cache, filling lines as needed.
+ * Returns false if the read must go to the target instead. */
+static bool mem_cache_read(target *t, void *dest, target_addr src, size_t len)
+{
+	struct target_mem_cache *c = t->mem_cache;
+	target_addr first = src & ~(MEM_CACHE_LINE_SIZE - 1);
+	target_addr last = (src + len - 1) & ~(MEM_CACHE_LINE_SIZE - 1);
+
+	/* Bulk reads would only thrash the cache */
+	if (!c->halted || !len || (last - first) >=
+	    (MEM_CACHE_LINES / 2) * MEM_CACHE_LINE_SIZE)
+		return false;
+	for (target_addr a = first; a <= last; a += MEM_CACHE_LINE_SIZE)
+		if (!mem_cache_cacheable(t, a))
+			return false;
+
+	for (target_addr a = first; a <= last; a += MEM_CACHE_LINE_SIZE) {
+		unsigned int i = (a / MEM_CACHE_LINE_SIZE) % MEM_CACHE_LINES;
+		if (c->line[i].addr == a) {
+			c->hits++;
+		} else {
+			c->misses++;
+			c->line[i].addr = MEM_CACHE_INVALID;
+			t->mem_read(t, c->line[i].data, a, MEM_CACHE_LINE_SIZE);
+			if (target_check_error(t))
+				return false;
+			c->line[i].addr = a;
+		}
+		target_addr start = MAX(a, src);
+		target_addr end = MIN(a + MEM_CACHE_LINE_SIZE, src + len);
+		memcpy(dest + (start - src), c->line[i].data + (start - a),
+		       end - start);
+	}
+	return true;
+}
+
 /* Memory access functions */
 int target_mem_read(target *t, void *dest, target_addr src, size_t len)
 {
+	if (t->mem_cache) {
+		if (mem_cache_read(t, dest, src, len))
+			return 0;
+		t->mem_cache->bypassed++;
+	}
 	t->mem_read(t, dest, src, len);
 	return target_check_error(t);
 }
 
 int target_mem_write(target *t, target_addr dest, const void *src, size_t len)
 {
+	target_mem_cache_invalidate(t);
 	t->mem_write(t, dest, src, len);
 	return target_check_error(t);
 }
@@ -406,14 +998,32 @@ void target_regs_write(target *t, const void *data)
 }
 
 /* Halt/resume functions */
-void target_reset(target *t) { t->reset(t); }
+void target_reset(target *t)
+{
+	if (t->mem_cache) {
+		target_mem_cache_invalidate(t);
+		t->mem_cache->halted = false;
+	}
+	t->reset(t);
+}
+
 void target_halt_request(target *t) { t->halt_request(t); }
 enum target_halt_reason target_halt_poll(target *t, target_addr *watch)
 {
-	return t->halt_poll(t, watch);
+	enum target_halt_reason reason = t->halt_poll(t, watch);
+	if (t->mem_cache && (reason != TARGET_HALT_RUNNING))
+		t->mem_cache->halted = true;
+	return reason;
 }
 
-void target_halt_resume(target *t, bool step) { t->halt_resume(t, step); }
+void target_halt_resume(target *t, bool step)
+{
+	if (t->mem_cache) {
+		target_mem_cache_invalidate(t);
+		t->mem_cache->halted = false;
+	}
+	t->halt_resume(t, step);
+}
 
 /* Command line for semihosting get_cmdline */
 void target_set_cmdline(target *t, char *cmdline) {
@@ -533,6 +1143,7 @@ uint32_t target_mem_read32(target *t, uint32_t addr)
 
 void target_mem_write32(target *t, uint32_t addr, uint32_t value)
 {
+	target_mem_cache_invalidate(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -545,6 +1156,7 @@ uint16_t target_mem_read16(target *t, uint32_t addr)
 
 void target_mem_write16(target *t, uint32_t addr, uint16_t value)
 {
+	target_mem_cache_invalidate(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -557,6 +1169,7 @@ uint8_t target_mem_read8(target *t, uint32_t addr)
 
 void target_mem_write8(target *t, uint32_t addr, uint8_t value)
 {
+	target_mem_cache_invalidate(t);
 	t->mem_write(t, addr, &value, sizeof(value));
 }
 
@@ -571,6 +1184,8 @@ void target_command_help(target *t)
 
 int target_command(target *t, int argc, const char *argv[])
 {
+	/* Driver commands may change memory behind our back */
+	target_mem_cache_invalidate(t);
 	for (struct target_command_s *tc = t->commands; tc; tc = tc->next)
 		for(const struct command_s *c = tc->cmds; c->cmd; c++)
 			if(!strncmp(argv[0], c->cmd, strlen(argv[0])))
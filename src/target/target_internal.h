@@ -35,6 +35,14 @@ typedef int (*flash_erase_func)(struct target_flash *f, target_addr addr, size_t
 typedef int (*flash_write_func)(struct target_flash *f, target_addr dest,
                                 const void *src, size_t len);
 typedef int (*flash_done_func)(struct target_flash *f);
+/* Patches data the way write() will before it reaches the flash */
+typedef void (*flash_fixup_func)(struct target_flash *f, target_addr dest,
+                                 void *buf, size_t len);
+/* Erases the whole bank a flash belongs to */
+typedef int (*flash_erase_bank_func)(struct target_flash *f);
+/* Returns > 0 while the write is still in progress, 0 when it completed
+ * and < 0 if it failed. */
+typedef int (*flash_poll_func)(struct target_flash *f);
 struct target_flash {
 	target_addr start;
 	size_t length;
@@ -42,12 +50,46 @@ struct target_flash {
 	flash_erase_func erase;
 	flash_write_func write;
 	flash_done_func done;
+	/* Optional, applied to a block before incremental flashing compares
+	 * it with the flash, e.g. for a boot checksum the driver fills in */
+	flash_fixup_func fixup;
+	/* Optional asynchronous write. write_start() returns once src has
+	 * been transferred to the target, while the flash may still be
+	 * programming. It may be called again before the previous write
+	 * completed: the driver then transfers the new block into a second
+	 * target buffer and only waits for the previous write before starting
+	 * the next one, so the link and the flash controller work in parallel.
+	 * The generic code calls write_poll() until completion before erase
+	 * and done.
+	 */
+	flash_write_func write_start;
+	flash_poll_func write_poll;
+	bool write_pending;
+	/* Optional bank or mass erase of bank_length bytes from bank_start,
+	 * which may span several target_flash. The generic code uses it when
+	 * an erase request covers the whole bank. A zero bank_length means
+	 * the bank is this flash. */
+	flash_erase_bank_func erase_bank;
+	target_addr bank_start;
+	size_t bank_length;
 	target *t;
 	uint8_t erased;
 	size_t buf_size;
+	/* Optional largest length write() takes, a power of two multiple of
+	 * buf_size. The buffer grows towards it up to the erase block size
+	 * and the size of the sector buffer arena. */
+	size_t writesize;
 	struct target_flash *next;
 	target_addr buf_addr;
 	void *buf;
+	bool buf_in_arena;
+	/* Incremental flashing: erase blocks GDB asked to erase and the
+	 * data collected for the erase block at inc_addr */
+	uint8_t *erase_pending;
+	uint8_t *inc_buf;
+	target_addr inc_addr;
+	/* Statistics of this flash region, drivers count their busy polls */
+	struct target_flash_stats stats;
 };
 
 typedef bool (*cmd_handler)(target *t, int argc, const char **argv);
@@ -122,6 +164,13 @@ struct target_s {
 	struct target_ram *ram;
 	struct target_flash *flash;
 
+	/* Optional read cache, see target_mem_cache_enable() */
+	struct target_mem_cache *mem_cache;
+
+	/* Statistics of the flash session, active until target_flash_done() */
+	struct target_flash_stats flash_stats;
+	bool flash_active;
+
 	/* Other stuff */
 	const char *driver;
 	uint32_t cpuid;
@@ -140,6 +189,7 @@ void target_mem_map_free(target *t);
 void target_add_commands(target *t, const struct command_s *cmds, const char *name);
 void target_add_ram(target *t, target_addr start, uint32_t len);
 void target_add_flash(target *t, struct target_flash *f);
+void target_mem_cache_invalidate(target *t);
 
 /* Convenience function for MMIO access */
 uint32_t target_mem_read32(target *t, uint32_t addr);